@@ -1,4 +1,17 @@
 #include <bits/stdc++.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JUDGE_X86_SIMD
+#endif
 using namespace std;
 
 template <typename T>
@@ -15,30 +28,296 @@ bool Eq(const T& t1, const T& t2) {
   return t1 == t2;
 }
 
-bool mocked_error;
-string last_error;
+// Errors print and exit, unless they are mocked. Mocked errors set the
+// calling thread's error status instead: error_raised, with the first message
+// in last_error. Functions that raise an error return right away, and their
+// callers check Failed() after anything that can raise, so errors propagate
+// back to CatchError without exceptions. Thread-local, so that judges running
+// on several threads can each catch their own errors.
+thread_local bool mocked_error;
+thread_local bool error_raised;
+thread_local string last_error;
 
 void Error(const string& msg) {
   if (mocked_error) {
+    // Keep the first error; later ones follow from it.
+    if (error_raised) return;
+    error_raised = true;
     last_error = msg;
-    // throw to avoid additional errors.
-    throw 1;
   } else {
     cerr << msg << endl;
     exit(1);
   }
 }
 
-#define AssertError(call, err) \
-  mocked_error = true;         \
-  try {                        \
-    call;                      \
-  } catch (...) {              \
-  }                            \
-  assert(last_error == err);   \
-  last_error = "";             \
+// Whether a mocked error was raised and not yet caught.
+bool Failed() { return error_raised; }
+
+#define AssertError(call, err)               \
+  mocked_error = true;                       \
+  call;                                      \
+  assert(error_raised && last_error == err); \
+  error_raised = false;                      \
+  last_error = "";                           \
   mocked_error = false;
 
+// Runs f with Error mocked, so that it raises instead of exiting. Returns false
+// with the message if it did, clearing the error status.
+bool CatchError(const function<void()>& f, string* error) {
+  const bool was_mocked = mocked_error;
+  mocked_error = true;
+  f();
+  const bool ok = !error_raised;
+  if (!ok) *error = last_error;
+  error_raised = false;
+  last_error = "";
+  mocked_error = was_mocked;
+  return ok;
+}
+
+const string kJudgeTimeLimitError = "Judge time limit exceeded";
+// Exit code of a judge that ran out of CPU time, as opposed to 1 for an
+// attempt that was rejected.
+const int kJudgeTimeLimitExitCode = 2;
+
+// Like Error, for a judge that ran out of CPU time before reaching a verdict.
+void JudgeTimeLimitExceeded() {
+  if (mocked_error) {
+    Error(kJudgeTimeLimitError);
+  } else {
+    cerr << kJudgeTimeLimitError << endl;
+    exit(kJudgeTimeLimitExitCode);
+  }
+}
+
+// CPU time used by the calling thread, in nanoseconds.
+int64_t ThreadCpuTimeNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// CPU time charged to the calling thread: its own, plus that of the helper
+// threads and processes that worked for it in a CpuPool.
+thread_local int64_t helper_cpu_ns;
+
+int64_t JudgeCpuTimeNs() { return ThreadCpuTimeNs() + helper_cpu_ns; }
+
+// CPU deadline of the calling thread in JudgeCpuTimeNs time, or 0 for none.
+// Long loops call CheckDeadline at case and step boundaries, so judging is
+// cancelled cooperatively. JudgeCasesFrom gives each case case_cpu_budget_ns
+// on top of that, if it is not 0.
+thread_local int64_t cpu_deadline_ns;
+thread_local int64_t case_cpu_budget_ns;
+
+// CPU time a thread and its helpers have used since a CpuPool was made, and
+// what was left of the thread's deadline then (0 for none). It lives in
+// shared memory, so helpers may be forked processes.
+struct CpuPoolState {
+  atomic<int64_t> used_ns;
+  int64_t budget_ns;
+};
+
+// The pool the calling thread works in, if any, and its JudgeCpuTimeNs when
+// it last reported to it.
+thread_local CpuPoolState* cpu_pool;
+thread_local int64_t cpu_pool_reported_ns;
+
+// Threads report to their pool in steps of at least this much CPU time, so
+// that they do not contend for it at every check.
+const int64_t kCpuPoolReportNs = 1000000;
+
+// Adds the calling thread's CPU time since its last report to its pool, if
+// it is at least kCpuPoolReportNs or flush is set. Returns whether the pool's
+// budget is spent, counting the time not yet reported.
+bool ReportToCpuPool(bool flush = false) {
+  const int64_t now = JudgeCpuTimeNs();
+  const int64_t unreported_ns = now - cpu_pool_reported_ns;
+  int64_t used_ns;
+  if (flush || unreported_ns >= kCpuPoolReportNs) {
+    used_ns = cpu_pool->used_ns.fetch_add(unreported_ns) + unreported_ns;
+    cpu_pool_reported_ns = now;
+  } else {
+    used_ns = cpu_pool->used_ns.load(memory_order_relaxed) + unreported_ns;
+  }
+  return cpu_pool->budget_ns != 0 && used_ns > cpu_pool->budget_ns;
+}
+
+void CheckDeadline() {
+  if ((cpu_pool != nullptr && ReportToCpuPool()) ||
+      (cpu_deadline_ns != 0 && JudgeCpuTimeNs() > cpu_deadline_ns))
+    JudgeTimeLimitExceeded();
+}
+
+// Shares what is left of the calling thread's deadline with the threads or
+// forked processes that work for it in parallel, for the lifetime of the
+// object. Each of them makes a CpuPool::Helper; CheckDeadline in any of them
+// then fails once all of them together have used the budget, so running in
+// parallel never stretches the deadline. When the pool is destroyed, after
+// the helpers are done, their CPU time is charged to the calling thread.
+class CpuPool {
+ public:
+  CpuPool()
+      : saved_pool_(cpu_pool),
+        saved_reported_ns_(cpu_pool_reported_ns),
+        start_ns_(JudgeCpuTimeNs()) {
+    void* p = mmap(nullptr, sizeof(CpuPoolState), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    // Without shared memory, forked helpers only see their own CPU time.
+    state_ = p == MAP_FAILED ? new CpuPoolState : new (p) CpuPoolState;
+    state_->used_ns = 0;
+    state_->budget_ns =
+        cpu_deadline_ns == 0 ? 0
+                             : max<int64_t>(1, cpu_deadline_ns - start_ns_);
+    // A pool inside another one gets no more than is left of that one.
+    if (cpu_pool != nullptr && cpu_pool->budget_ns != 0) {
+      const int64_t left_ns = max<int64_t>(
+          1, cpu_pool->budget_ns - cpu_pool->used_ns -
+                 (start_ns_ - cpu_pool_reported_ns));
+      if (state_->budget_ns == 0 || left_ns < state_->budget_ns)
+        state_->budget_ns = left_ns;
+    }
+    mapped_ = p != MAP_FAILED;
+    cpu_pool = state_;
+    cpu_pool_reported_ns = start_ns_;
+  }
+  ~CpuPool() {
+    ReportToCpuPool(true);
+    helper_cpu_ns += state_->used_ns - (JudgeCpuTimeNs() - start_ns_);
+    cpu_pool = saved_pool_;
+    cpu_pool_reported_ns = saved_reported_ns_;
+    if (mapped_) {
+      munmap(state_, sizeof(CpuPoolState));
+    } else {
+      delete state_;
+    }
+  }
+
+  CpuPool(const CpuPool&) = delete;
+  CpuPool& operator=(const CpuPool&) = delete;
+
+  // Makes the calling thread work in pool for the lifetime of the object,
+  // with no deadline but the pool's. A forked process must destroy it before
+  // it exits, or its last CPU time is not charged.
+  class Helper {
+   public:
+    explicit Helper(const CpuPool& pool)
+        : saved_pool_(cpu_pool),
+          saved_reported_ns_(cpu_pool_reported_ns),
+          saved_deadline_ns_(cpu_deadline_ns) {
+      cpu_pool = pool.state_;
+      cpu_pool_reported_ns = JudgeCpuTimeNs();
+      cpu_deadline_ns = 0;
+    }
+    ~Helper() {
+      ReportToCpuPool(true);
+      cpu_pool = saved_pool_;
+      cpu_pool_reported_ns = saved_reported_ns_;
+      cpu_deadline_ns = saved_deadline_ns_;
+    }
+
+    Helper(const Helper&) = delete;
+    Helper& operator=(const Helper&) = delete;
+
+   private:
+    CpuPoolState* const saved_pool_;
+    const int64_t saved_reported_ns_;
+    const int64_t saved_deadline_ns_;
+  };
+
+ private:
+  CpuPoolState* const saved_pool_;
+  const int64_t saved_reported_ns_;
+  const int64_t start_ns_;
+  CpuPoolState* state_;
+  bool mapped_;
+};
+
+// Moves the calling thread's deadline to at most budget_ns from now for the
+// lifetime of the object. A budget of 0 leaves it as it is.
+class ScopedDeadline {
+ public:
+  explicit ScopedDeadline(int64_t budget_ns) : saved_(cpu_deadline_ns) {
+    if (budget_ns <= 0) return;
+    const int64_t deadline = JudgeCpuTimeNs() + budget_ns;
+    if (cpu_deadline_ns == 0 || deadline < cpu_deadline_ns)
+      cpu_deadline_ns = deadline;
+  }
+  ~ScopedDeadline() { cpu_deadline_ns = saved_; }
+
+  ScopedDeadline(const ScopedDeadline&) = delete;
+  ScopedDeadline& operator=(const ScopedDeadline&) = delete;
+
+ private:
+  const int64_t saved_;
+};
+
+// Burns at least ns of the calling thread's CPU time, for tests.
+void SpinCpu(int64_t ns) {
+  const int64_t end = ThreadCpuTimeNs() + ns;
+  while (ThreadCpuTimeNs() < end) {
+  }
+}
+
+void TestDeadlines() {
+  CheckDeadline();
+  {
+    ScopedDeadline deadline(1000000);
+    const int64_t tight = cpu_deadline_ns;
+    {
+      ScopedDeadline looser(1000000000);
+      assert(cpu_deadline_ns == tight);
+    }
+    assert(cpu_deadline_ns == tight);
+    CheckDeadline();
+    SpinCpu(2000000);
+    AssertError(CheckDeadline(), kJudgeTimeLimitError);
+  }
+  assert(cpu_deadline_ns == 0);
+  CheckDeadline();
+  // Two helpers of 30ms each spend a pooled budget of 50ms between them, and
+  // the caller is charged for both.
+  {
+    ScopedDeadline deadline(50000000);
+    {
+      CpuPool pool;
+      vector<string> errors(2);
+      vector<thread> helpers;
+      for (string& error : errors) {
+        helpers.emplace_back([&pool, &error] {
+          CpuPool::Helper helper(pool);
+          CatchError(
+              [] {
+                SpinCpu(30000000);
+                CheckDeadline();
+              },
+              &error);
+        });
+      }
+      for (thread& t : helpers) t.join();
+      assert(count(errors.begin(), errors.end(), kJudgeTimeLimitError) == 1);
+    }
+    AssertError(CheckDeadline(), kJudgeTimeLimitError);
+  }
+  const int64_t charged_ns = helper_cpu_ns;
+  {
+    CpuPool pool;
+    thread([&pool] {
+      CpuPool::Helper helper(pool);
+      SpinCpu(1000000);
+      CheckDeadline();
+    }).join();
+  }
+  assert(helper_cpu_ns >= charged_ns + 1000000);
+  assert(cpu_pool == nullptr);
+}
+
+// CPU budgets of judging one attempt, in nanoseconds, or 0 for none.
+struct JudgeBudgets {
+  int64_t run_ns = 0;
+  int64_t case_ns = 0;
+};
+
 string Strint(long long n) {
   ostringstream out;
   out << n;
@@ -63,29 +342,94 @@ void TestTruncate() {
   assert(Truncate(string(51, 'x')) == string(47, 'x') + "...");
 }
 
-// Parses ints in [-10^18, 10^18] or raises Error.
-long long ParseInt(const string& ss) {
-  const string error = string("Not an integer in range: ") + Truncate(ss);
-  if (ss[0] != '-' && (ss[0] < '0' || ss[0] > '9')) Error(error);
-  for (int i = 1; i < ss.size(); ++i)
-    if (ss[i] < '0' || ss[i] > '9') Error(error);
-  string s;
-  if (!ss.empty()) {
-    int first_digit = 0;
-    if (ss[0] == '-') {
-      s += '-';
-      first_digit = 1;
-    }
-    while (first_digit < ss.size() - 1 && ss[first_digit] == '0') ++first_digit;
-    s += ss.substr(first_digit);
-  }
-  if (s.empty() || s.size() > 20) Error(error);
-  if (s.size() == 20 && s != string("-1") + string(18, '0')) Error(error);
-  if (s.size() == 19 && s[0] != '-' && s != string("1") + string(18, '0'))
+// Errors of the parsing and judging hot paths. The context of an error is
+// captured in a Diagnostic, and its message is only built when it is raised.
+enum DiagnosticCode {
+  kNotAnInteger,           // token.
+  kBadCaseLine,
+  kFirstLineNotCase,
+  kUnexpectedCaseNumber,   // token, expected.
+  kWrongNumberOfCases,     // found, expected.
+  kInvalidOutputByte,      // found (the byte), line.
+  kNotADecimal,            // token.
+  kNotABigInteger,         // token.
+};
+
+struct Diagnostic {
+  DiagnosticCode code = kNotAnInteger;
+  string_view token = {};
+  long long found = 0;
+  long long expected = 0;
+  long long line = 0;
+};
+
+string RenderDiagnostic(const Diagnostic& d) {
+  switch (d.code) {
+    case kNotAnInteger:
+      return "Not an integer in range: " + Truncate(string(d.token));
+    case kBadCaseLine:
+      return "Bad format in case line";
+    case kFirstLineNotCase:
+      return "First line doesn't start with case #1:";
+    case kUnexpectedCaseNumber:
+      return "Found case: " + Truncate(string(d.token)) +
+             ", expected: " + Strint(d.expected);
+    case kWrongNumberOfCases:
+      return "Wrong number of cases in attempt: " + Strint(d.found) +
+             ", expected: " + Strint(d.expected);
+    case kNotABigInteger:
+      return "Not an integer: " + Truncate(string(d.token));
+    case kNotADecimal:
+      return "Not a decimal number in range: " + Truncate(string(d.token));
+    case kInvalidOutputByte: {
+      char byte[8];
+      snprintf(byte, sizeof(byte), "0x%02llX", d.found);
+      return string("Invalid byte ") + byte + " in output on line " +
+             Strint(d.line);
+    }
+  }
+  return "";
+}
+
+void Error(const Diagnostic& d) {
+  // Later mocked errors are dropped, so do not render them.
+  if (mocked_error && error_raised) return;
+  Error(RenderDiagnostic(d));
+}
+
+void TestRenderDiagnostic() {
+  assert(RenderDiagnostic({kNotAnInteger, "1.5"}) ==
+         "Not an integer in range: 1.5");
+  assert(RenderDiagnostic({kUnexpectedCaseNumber, string(60, '7'), 0, 3}) ==
+         "Found case: " + string(47, '7') + "..., expected: 3");
+  assert(RenderDiagnostic({kWrongNumberOfCases, "", 1, 2}) ==
+         "Wrong number of cases in attempt: 1, expected: 2");
+  assert(RenderDiagnostic({kInvalidOutputByte, "", 0xe9, 0, 3}) ==
+         "Invalid byte 0xE9 in output on line 3");
+}
+
+// Parses ints in [-10^18, 10^18] or raises Error and returns 0.
+long long ParseInt(string_view ss) {
+  const Diagnostic error = {kNotAnInteger, ss};
+  if (ss.empty() || (ss[0] != '-' && (ss[0] < '0' || ss[0] > '9'))) {
+    Error(error);
+    return 0;
+  }
+  for (size_t i = 1; i < ss.size(); ++i) {
+    if (ss[i] < '0' || ss[i] > '9') {
+      Error(error);
+      return 0;
+    }
+  }
+  // Only digits and a leading '-' are left, which from_chars parses in place.
+  const long long kMax = 1000000000000000000;
+  long long r = 0;
+  const char* end = ss.data() + ss.size();
+  const from_chars_result parsed = from_chars(ss.data(), end, r);
+  if (parsed.ec != errc() || parsed.ptr != end || r < -kMax || r > kMax) {
     Error(error);
-  istringstream in(s);
-  long long r;
-  in >> r;
+    return 0;
+  }
   return r;
 }
 
@@ -103,7 +447,12 @@ void TestParseInt() {
   assert(ParseInt(string("-1") + string(18, '0')) == -1000000000000000000);
   assert(ParseInt(string("-0001") + string(18, '0')) == -1000000000000000000);
   AssertError(ParseInt(""), "Not an integer in range: ");
+  // An empty view into a longer buffer, whose first byte is not read.
+  AssertError(ParseInt(string_view("5", 0)), "Not an integer in range: ");
   AssertError(ParseInt("a"), "Not an integer in range: a");
+  AssertError(ParseInt("-"), "Not an integer in range: -");
+  AssertError(ParseInt(string(30, '9')),
+              "Not an integer in range: " + Truncate(string(30, '9')));
   AssertError(ParseInt("1a1"), "Not an integer in range: 1a1");
   AssertError(ParseInt(string("1") + string(17, '0') + "1"),
               "Not an integer in range: 1000000000000000001");
@@ -113,6 +462,243 @@ void TestParseInt() {
   AssertError(ParseInt("1.0"), "Not an integer in range: 1.0");
 }
 
+// Parses decimal numbers such as -12, 0.5 or 1.5e-7 into the nearest double,
+// or raises Error and returns 0. Unlike strtod, it takes no sign '+', no
+// leading or trailing '.', no hexadecimal, infinities or NaN, and nothing
+// whose magnitude overflows or underflows a double. Does not allocate.
+double ParseDouble(string_view s) {
+  const Diagnostic error = {kNotADecimal, s};
+  size_t i = s.empty() || s[0] != '-' ? 0 : 1;
+  auto digits = [&] {
+    const size_t begin = i;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9') ++i;
+    return i > begin;
+  };
+  bool ok = digits();
+  if (ok && i < s.size() && s[i] == '.') {
+    ++i;
+    ok = digits();
+  }
+  if (ok && i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+    ++i;
+    if (i < s.size() && (s[i] == '+' || s[i] == '-')) ++i;
+    ok = digits();
+  }
+  double r = 0;
+  if (!ok || i != s.size() ||
+      from_chars(s.data(), s.data() + s.size(), r).ec != errc()) {
+    Error(error);
+    return 0;
+  }
+  return r;
+}
+
+void TestParseDouble() {
+  assert(ParseDouble("0") == 0 && !signbit(ParseDouble("0")));
+  assert(ParseDouble("-0") == 0 && signbit(ParseDouble("-0")));
+  assert(ParseDouble("1.5") == 1.5);
+  assert(ParseDouble("-00.25") == -0.25);
+  assert(ParseDouble("1e3") == 1000);
+  assert(ParseDouble("1E-3") == 0.001);
+  assert(ParseDouble("-2.5e+2") == -250);
+  assert(ParseDouble("0.1") == 0.1);
+  assert(ParseDouble("0.30000000000000004") == 0.1 + 0.2);
+  assert(ParseDouble("0.3") != 0.1 + 0.2);
+  assert(ParseDouble("123456789012345678901234567890") ==
+         1.2345678901234568e29);
+  assert(ParseDouble("1.7976931348623157e308") == DBL_MAX);
+  assert(ParseDouble("4.9406564584124654e-324") == 4.9406564584124654e-324);
+  for (const string s : {"", "-", "+1", ".5", "1.", "-.5", "1e", "1e+", "e5",
+                         "inf", "-inf", "nan", "0x1p3", "1,5", "1.5.2", "--1",
+                         " 1", "1 ", "1e400", "-1e400", "1e-400", "1d"}) {
+    AssertError(ParseDouble(s), "Not a decimal number in range: " + s);
+  }
+}
+
+// Integers of any length, for answers past ParseInt's range: a sign and the
+// magnitude in base 10^18 limbs, least significant first. Values are always
+// canonical: no zero high limbs, and 0 has no limbs and is not negative.
+struct BigInt {
+  bool negative = false;
+  vector<uint64_t> limbs;
+};
+
+const uint64_t kBigIntBase = 1000000000000000000ULL;
+const int kBigIntBaseDigits = 18;
+
+// Parses an optional '-' and one or more digits into a canonical BigInt in
+// one pass and a single allocation, or raises Error and returns 0. Leading
+// zeros are dropped, and "-0" is 0.
+BigInt ParseBigInt(string_view s) {
+  BigInt r;
+  size_t i = !s.empty() && s[0] == '-' ? 1 : 0;
+  if (i == s.size()) {
+    Error(Diagnostic{kNotABigInteger, s});
+    return r;
+  }
+  while (i < s.size() && s[i] == '0') ++i;
+  const size_t first_significant = i;
+  r.limbs.resize((s.size() - first_significant + kBigIntBaseDigits - 1) /
+                 kBigIntBaseDigits);
+  for (size_t k = 0; k < r.limbs.size(); ++k) {
+    const size_t end = s.size() - k * kBigIntBaseDigits;
+    const size_t begin = end - first_significant > kBigIntBaseDigits
+                             ? end - kBigIntBaseDigits
+                             : first_significant;
+    uint64_t limb = 0;
+    for (size_t j = begin; j < end; ++j) {
+      const unsigned digit = s[j] - '0';
+      if (digit > 9) {
+        Error(Diagnostic{kNotABigInteger, s});
+        return BigInt();
+      }
+      limb = limb * 10 + digit;
+    }
+    r.limbs[k] = limb;
+  }
+  r.negative = s[0] == '-' && !r.limbs.empty();
+  return r;
+}
+
+string BigIntToString(const BigInt& a) {
+  if (a.limbs.empty()) return "0";
+  string r = a.negative ? "-" : "";
+  r += to_string(a.limbs.back());
+  char limb[kBigIntBaseDigits + 1];
+  for (size_t k = a.limbs.size() - 1; k-- > 0;) {
+    snprintf(limb, sizeof(limb), "%018llu", (unsigned long long)a.limbs[k]);
+    r += limb;
+  }
+  return r;
+}
+
+// -1, 0 or 1 as |a| is less than, equal to or greater than |b|.
+int CompareLimbs(const vector<uint64_t>& a, const vector<uint64_t>& b) {
+  if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+  for (size_t k = a.size(); k-- > 0;)
+    if (a[k] != b[k]) return a[k] < b[k] ? -1 : 1;
+  return 0;
+}
+
+// -1, 0 or 1 as a is less than, equal to or greater than b.
+int CompareBigInt(const BigInt& a, const BigInt& b) {
+  if (a.negative != b.negative) return a.negative ? -1 : 1;
+  const int c = CompareLimbs(a.limbs, b.limbs);
+  return a.negative ? -c : c;
+}
+
+bool operator==(const BigInt& a, const BigInt& b) {
+  return CompareBigInt(a, b) == 0;
+}
+bool operator!=(const BigInt& a, const BigInt& b) { return !(a == b); }
+bool operator<(const BigInt& a, const BigInt& b) {
+  return CompareBigInt(a, b) < 0;
+}
+
+// |a| + |b|.
+vector<uint64_t> AddLimbs(const vector<uint64_t>& a,
+                          const vector<uint64_t>& b) {
+  const vector<uint64_t>& longer = a.size() >= b.size() ? a : b;
+  const vector<uint64_t>& shorter = a.size() >= b.size() ? b : a;
+  vector<uint64_t> r;
+  r.reserve(longer.size() + 1);
+  uint64_t carry = 0;
+  for (size_t k = 0; k < longer.size(); ++k) {
+    uint64_t limb = longer[k] + (k < shorter.size() ? shorter[k] : 0) + carry;
+    carry = limb >= kBigIntBase;
+    if (carry) limb -= kBigIntBase;
+    r.push_back(limb);
+  }
+  if (carry) r.push_back(carry);
+  return r;
+}
+
+// |a| - |b|, for |a| >= |b|.
+vector<uint64_t> SubtractLimbs(const vector<uint64_t>& a,
+                               const vector<uint64_t>& b) {
+  vector<uint64_t> r(a.size());
+  uint64_t borrow = 0;
+  for (size_t k = 0; k < a.size(); ++k) {
+    const uint64_t sub = (k < b.size() ? b[k] : 0) + borrow;
+    borrow = a[k] < sub;
+    r[k] = borrow ? a[k] + kBigIntBase - sub : a[k] - sub;
+  }
+  while (!r.empty() && r.back() == 0) r.pop_back();
+  return r;
+}
+
+BigInt SubtractBigInt(const BigInt& a, const BigInt& b) {
+  BigInt r;
+  if (a.negative != b.negative) {
+    r.limbs = AddLimbs(a.limbs, b.limbs);
+    r.negative = a.negative;
+  } else if (CompareLimbs(a.limbs, b.limbs) >= 0) {
+    r.limbs = SubtractLimbs(a.limbs, b.limbs);
+    r.negative = a.negative && !r.limbs.empty();
+  } else {
+    r.limbs = SubtractLimbs(b.limbs, a.limbs);
+    r.negative = !a.negative;
+  }
+  return r;
+}
+
+BigInt AddBigInt(const BigInt& a, BigInt b) {
+  b.negative = !b.negative && !b.limbs.empty();
+  return SubtractBigInt(a, b);
+}
+
+void TestBigInt() {
+  assert(BigIntToString(ParseBigInt("0")) == "0");
+  assert(ParseBigInt("-0").limbs.empty() && !ParseBigInt("-0").negative);
+  assert(ParseBigInt("-000").limbs.empty() && !ParseBigInt("-000").negative);
+  assert(BigIntToString(ParseBigInt("-000123")) == "-123");
+  const string big = "1" + string(40, '0');
+  assert(BigIntToString(ParseBigInt("000" + big)) == big);
+  assert(ParseBigInt(big).limbs == vector<uint64_t>({0, 0, 10000}));
+  assert(ParseBigInt(string(36, '9')).limbs.size() == 2);
+  for (const string s : {"", "-", "+1", "1a", "--1", "1.0", " 1", "-a",
+                         "00x"}) {
+    AssertError(ParseBigInt(s), "Not an integer: " + s);
+  }
+  AssertError(ParseBigInt(big + "x"), "Not an integer: " + Truncate(big + "x"));
+  assert(SubtractBigInt(ParseBigInt(big), ParseBigInt("1")) ==
+         ParseBigInt(string(40, '9')));
+  assert(BigIntToString(SubtractBigInt(ParseBigInt("-5"), ParseBigInt("7"))) ==
+         "-12");
+  assert(BigIntToString(AddBigInt(ParseBigInt("-5"), ParseBigInt("5"))) == "0");
+  assert(!AddBigInt(ParseBigInt("-5"), ParseBigInt("5")).negative);
+  assert(ParseBigInt("-2") < ParseBigInt("-1"));
+  assert(ParseBigInt("-1" + big) < ParseBigInt("-1"));
+  assert(ParseBigInt("-1") < ParseBigInt("0"));
+  assert(ParseBigInt("0") < ParseBigInt(big));
+  // Against __int128, on values up to 10^36.
+  auto to_string128 = [](__int128 v) {
+    string r;
+    const bool negative = v < 0;
+    do {
+      r += char('0' + (int)(negative ? -(v % 10) : v % 10));
+      v /= 10;
+    } while (v != 0);
+    if (negative) r += '-';
+    return string(r.rbegin(), r.rend());
+  };
+  mt19937_64 rng(3);
+  for (int t = 0; t < 2000; ++t) {
+    __int128 v[2];
+    for (__int128& x : v) {
+      x = 0;
+      for (int d = rng() % 37; d > 0; --d) x = x * 10 + rng() % 10;
+      if (rng() % 2) x = -x;
+    }
+    const BigInt a = ParseBigInt(to_string128(v[0]));
+    const BigInt b = ParseBigInt(to_string128(v[1]));
+    assert(BigIntToString(a) == to_string128(v[0]));
+    assert(CompareBigInt(a, b) == (v[0] < v[1] ? -1 : v[0] > v[1] ? 1 : 0));
+    assert(BigIntToString(SubtractBigInt(a, b)) == to_string128(v[0] - v[1]));
+    assert(BigIntToString(AddBigInt(a, b)) == to_string128(v[0] + v[1]));
+  }
+}
+
 string Lowercase(const string& s) {
   string r(s);
   for (char& c : r) c = tolower(c);
@@ -143,34 +729,178 @@ void TestTokenize() {
          vector<string>({"1", "2", "3", "4"}));
 }
 
+// Opens filename for reading, or duplicates stdin for "-", so that the caller
+// can close either. Returns -1 if it cannot be opened.
+int OpenInputFile(const string& filename) {
+  return filename == "-" ? dup(0) : open(filename.c_str(), O_RDONLY);
+}
+
+// Size of the reads of files that are not mapped, such as pipes and sockets.
+const size_t kReadBlockBytes = 1 << 20;
+
+// Reads fd to its end, in blocks of at least kReadBlockBytes read straight
+// into the result. Regular files are read in one block of their size.
+string ReadAll(int fd) {
+  struct stat st;
+  size_t block = kReadBlockBytes;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    block = max<size_t>(block, st.st_size + 1);
+  string r(block, '\0');
+  size_t size = 0;
+  for (;;) {
+    if (size == r.size()) r.resize(2 * r.size());
+    const ssize_t n = read(fd, &r[size], r.size() - size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    size += n;
+  }
+  r.resize(size);
+  return r;
+}
+
+// Reads the lines of fd in blocks of block_size, finding line ends with
+// memchr. Does not own fd.
+class LineReader {
+ public:
+  explicit LineReader(int fd, size_t block_size = kReadBlockBytes)
+      : fd_(fd), block_size_(block_size) {}
+
+  // Next line, without its '\n', valid until the next call. Returns false at
+  // the end; a last line without '\n' is still a line.
+  bool Next(string_view* line) {
+    for (;;) {
+      const void* newline =
+          memchr(buffer_.data() + scan_, '\n', buffer_.size() - scan_);
+      if (newline != nullptr) {
+        const size_t end = (const char*)newline - buffer_.data();
+        *line = string_view(buffer_).substr(pos_, end - pos_);
+        pos_ = scan_ = end + 1;
+        return true;
+      }
+      scan_ = buffer_.size();
+      if (eof_) {
+        if (pos_ == buffer_.size()) return false;
+        *line = string_view(buffer_).substr(pos_);
+        pos_ = buffer_.size();
+        return true;
+      }
+      Fill();
+    }
+  }
+
+ private:
+  // Drops the lines before pos_ and appends the next block of fd.
+  void Fill() {
+    buffer_.erase(0, pos_);
+    scan_ -= pos_;
+    pos_ = 0;
+    const size_t size = buffer_.size();
+    buffer_.resize(size + block_size_);
+    ssize_t n;
+    do {
+      n = read(fd_, &buffer_[size], block_size_);
+    } while (n < 0 && errno == EINTR);
+    buffer_.resize(size + max<ssize_t>(n, 0));
+    if (n <= 0) eof_ = true;
+  }
+
+  const int fd_;
+  const size_t block_size_;
+  string buffer_;
+  size_t pos_ = 0;   // Start of the next line.
+  size_t scan_ = 0;  // No '\n' in buffer_[pos_, scan_).
+  bool eof_ = false;
+};
+
+void TestLineReader() {
+  for (const string data : {"", "\n", "a", "ab\n\ncd", "ab\ncd\n", "\n\nx\n"}) {
+    vector<string> expected;
+    istringstream in(data);
+    for (string line; getline(in, line);) expected.push_back(line);
+    for (size_t block_size : {1, 2, 3, 64}) {
+      int fds[2];
+      assert(pipe(fds) == 0);
+      assert(write(fds[1], data.data(), data.size()) == (ssize_t)data.size());
+      close(fds[1]);
+      LineReader reader(fds[0], block_size);
+      vector<string> lines;
+      for (string_view line; reader.Next(&line);) lines.emplace_back(line);
+      assert(Eq(lines, expected));
+      close(fds[0]);
+    }
+  }
+  // Lines longer than the pipe holds, read while they are written.
+  const string data = string(300000, 'x') + "\ny\n" + string(200000, 'z');
+  int fds[2];
+  assert(pipe(fds) == 0);
+  thread writer([&] {
+    assert(write(fds[1], data.data(), data.size()) == (ssize_t)data.size());
+    close(fds[1]);
+  });
+  assert(ReadAll(fds[0]) == data);
+  writer.join();
+  close(fds[0]);
+}
+
 vector<vector<string>> ReadAndTokenizeFileLines(const string& filename) {
-  ifstream in(filename);
-  string s;
+  const int fd = OpenInputFile(filename);
+  LineReader reader(fd);
+  vector<vector<string>> r;
+  for (string_view line; reader.Next(&line);) {
+    CheckDeadline();
+    if (Failed()) break;
+    vector<string> tokens = Tokenize(string(line));
+    if (!tokens.empty()) r.push_back(tokens);
+  }
+  if (fd >= 0) close(fd);
+  if (Failed()) return {};
+  return r;
+}
+
+// Like ReadAndTokenizeFileLines, for file contents already in memory.
+vector<vector<string>> TokenizeLines(string_view data) {
   vector<vector<string>> r;
-  while (getline(in, s)) {
-    vector<string> tokens = Tokenize(s);
+  for (size_t begin = 0; begin < data.size();) {
+    size_t end = data.find('\n', begin);
+    if (end == string_view::npos) end = data.size();
+    CheckDeadline();
+    if (Failed()) return {};
+    vector<string> tokens = Tokenize(string(data.substr(begin, end - begin)));
     if (!tokens.empty()) r.push_back(tokens);
+    begin = end + 1;
   }
   return r;
 }
 
-vector<vector<vector<string>>> SplitCases(const vector<vector<string>>& lines) {
+// Splits lines into cases, or raises Error and returns no cases. first_case is
+// the number the first case header must have, for splitting a part of a file
+// that starts at a case header.
+vector<vector<vector<string>>> SplitCases(const vector<vector<string>>& lines,
+                                          long long first_case = 1) {
   vector<vector<vector<string>>> cases;
   for (const vector<string>& line : lines) {
     if (line.size() >= 2 && line[0] == "case" &&
         line[1][0] == '#') {  // New case line, like python judges define it.
-      if (line[1].size() < 3 || line[1][line[1].size() - 1] != ':')
-        Error("Bad format in case line");
+      if (line[1].size() < 3 || line[1][line[1].size() - 1] != ':') {
+        Error(Diagnostic{kBadCaseLine});
+        return {};
+      }
       const string case_num = line[1].substr(1, line[1].size() - 2);
-      if (ParseInt(case_num) != cases.size() + 1) {
-        Error(string("Found case: ") + Truncate(case_num) +
-              ", expected: " + Strint(cases.size() + 1));
+      const long long n = ParseInt(case_num);
+      if (Failed()) return {};
+      if (n != cases.size() + first_case) {
+        Error(Diagnostic{kUnexpectedCaseNumber, case_num, 0,
+                         (long long)(cases.size() + first_case)});
+        return {};
       }
       vector<string> new_line(line);
       new_line.erase(new_line.begin(), new_line.begin() + 2);
       cases.push_back(vector<vector<string>>(1, new_line));
     } else {
-      if (cases.empty()) Error("First line doesn't start with case #1:");
+      if (cases.empty()) {
+        Error(Diagnostic{kFirstLineNotCase});
+        return {};
+      }
       cases.back().push_back(line);
     }
   }
@@ -235,172 +965,5716 @@ void TestSplitCases() {
   assert(Eq(SplitLines({"Case #01: A"}), {{{"a"}}}));
   AssertError(SplitLines({"", "Cases #1: A"}),
               "First line doesn't start with case #1:");
+  assert(Eq(SplitCases(TokenizeLines("Case #3: a\ncase #4: b"), 3),
+            {{{"a"}}, {{"b"}}}));
+  AssertError(SplitCases(TokenizeLines("Case #3: a\ncase #3: b"), 3),
+              "Found case: 3, expected: 4");
 }
 
-template <typename T>
-vector<T> ParseAllInput(const string& filename, T ParseCaseInputF(istream&)) {
-  ifstream in(filename);
-  int t;
-  in >> t;
-  vector<T> v(t);
-  for (int i = 0; i < t; ++i) v[i] = ParseCaseInputF(in);
-  return v;
+void TestTokenizeLines() {
+  assert(Eq(TokenizeLines(""), {}));
+  assert(Eq(TokenizeLines("\n\n"), {}));
+  assert(Eq(TokenizeLines("A b\n\n c\r\nd"), {{"a", "b"}, {"c"}, {"d"}}));
+  assert(Eq(TokenizeLines("a\n"), {{"a"}}));
 }
 
-template <typename U>
-vector<U> ParseAllOutput(const string& filename,
-                         U ParseCaseOutputF(const vector<vector<string>>&)) {
-  vector<vector<vector<string>>> tokenized_lines =
-      SplitCases(ReadAndTokenizeFileLines(filename));
-  vector<U> v(tokenized_lines.size());
-  for (int i = 0; i < tokenized_lines.size(); ++i)
-    v[i] = ParseCaseOutputF(tokenized_lines[i]);
-  return v;
+// Whitespace as istream's operator>> sees it.
+bool IsTokenSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
 }
 
-template <typename T, typename U>
-string JudgeAllCases(const vector<T>& input, const vector<U>& correct_output,
-                     const vector<U>& attempt,
-                     string JudgeCase(const T&, const U&, const U&)) {
-  if (attempt.size() != input.size())
-    Error(string("Wrong number of cases in attempt: ") +
-          Strint(attempt.size()) + ", expected: " + Strint(input.size()));
-  for (int i = 0; i < input.size(); ++i) {
-    string e = JudgeCase(input[i], correct_output[i], attempt[i]);
-    if (e.empty()) continue;
-    ostringstream out;
-    out << "Case #" << (i + 1) << ": " << e;
-    return out.str();
-  }
-  return "";
-}
+// Hot kernels of the judge in one implementation per SIMD level, all built
+// into the same binary with target attributes. The best level the CPU
+// supports is picked at startup, and SetSimdLevel (--simd=LEVEL) can force a
+// lower one for testing. The scalar kernels are the reference. ParseInt has
+// no kernel: its tokens are a few digits long, and once it parses them in
+// place with from_chars the digit loop is no longer where its time goes.
+// There is no AVX-512 level either, and AVX-512 nodes run the AVX2 kernels:
+// the kernels stream memory at a rate that 32-byte vectors already keep up
+// with, and on many of those CPUs 512-bit instructions lower the clock of the
+// core for the rest of the judge too.
+enum SimdLevel { kSimdScalar, kSimdSse42, kSimdAvx2, kNumSimdLevels };
 
-string JudgeCaseTest(const int& n, const int& m, const int& o) {
-  if (n != o) return Strint(o) + " not equal to input: " + Strint(n);
-  return "";
+struct SimdKernels {
+  const char* name;
+  // Offset of the first c in data[begin, end), or end.
+  size_t (*find_byte)(const char* data, size_t begin, size_t end, char c);
+  // Fills mask[0, n / 64 + 1) with a bit per byte of data[0, n), set for
+  // IsTokenSpace bytes and for the bits past n.
+  void (*space_mask)(const char* data, size_t n, uint64_t* mask);
+  // Lowercases the ASCII letters of data[0, n).
+  void (*fold_case)(char* data, size_t n);
+  // Index of the first element of v[0, n) outside [lo, hi], or n.
+  size_t (*find_out_of_range)(const int* v, size_t n, int lo, int hi);
+  // Index of the first minimum of v[0, n), for n > 0.
+  size_t (*min_index)(const int* v, size_t n);
+  // Offset of the first byte of data[begin, end) that is neither printable
+  // ASCII nor IsTokenSpace, or end.
+  size_t (*find_non_text)(const char* data, size_t begin, size_t end);
+  // Length of the longest common prefix of a[0, n) and b[0, n), ignoring the
+  // case of ASCII letters.
+  size_t (*common_folded_prefix)(const char* a, const char* b, size_t n);
+  // Index of the first got[i], i < n, not WithinTolerance of expected[i], or
+  // n.
+  size_t (*find_out_of_tolerance)(const double* expected, const double* got,
+                                  size_t n, double abs_tol, double rel_tol);
 };
 
-void TestJudgeAllCases() {
-  AssertError(JudgeAllCases({1}, {1}, {1, 2}, JudgeCaseTest),
-              "Wrong number of cases in attempt: 2, expected: 1");
-  AssertError(JudgeAllCases({1, 2}, {1, 2}, {1}, JudgeCaseTest),
-              "Wrong number of cases in attempt: 1, expected: 2");
-  AssertError(JudgeAllCases({1, 2}, {1, 2}, {}, JudgeCaseTest),
-              "Wrong number of cases in attempt: 0, expected: 2");
-  assert(JudgeAllCases({1}, {1}, {1}, JudgeCaseTest) == "");
-  assert(JudgeAllCases({1}, {1}, {2}, JudgeCaseTest) ==
-         "Case #1: 2 not equal to input: 1");
-  assert(JudgeAllCases({1, 1}, {1, 1}, {2, 2}, JudgeCaseTest) ==
-         "Case #1: 2 not equal to input: 1");
-  assert(JudgeAllCases({1, 2}, {1, 2}, {1, 2}, JudgeCaseTest) == "");
-  assert(JudgeAllCases({1, 2}, {1, 2}, {1, 1}, JudgeCaseTest) ==
-         "Case #2: 1 not equal to input: 2");
+// Whether got is within abs_tol of expected, or within rel_tol of it relative
+// to |expected|. NaN is never within tolerance.
+bool WithinTolerance(double expected, double got, double abs_tol,
+                     double rel_tol) {
+  const double diff = fabs(got - expected);
+  return diff <= abs_tol || diff <= rel_tol * fabs(expected);
 }
 
-void TestLib() {
-  TestStrint();
-  TestTruncate();
-  TestParseInt();
-  TestLowercase();
-  TestTokenize();
-  TestSplitCases();
-  TestJudgeAllCases();
+size_t FindByteScalar(const char* data, size_t begin, size_t end, char c) {
+  while (begin < end && data[begin] != c) ++begin;
+  return begin;
 }
 
-//////////////////////////////////////////////
+void SpaceMaskScalar(const char* data, size_t n, uint64_t* mask) {
+  fill(mask, mask + n / 64 + 1, ~0ULL);
+  for (size_t i = 0; i < n; ++i)
+    if (!IsTokenSpace(data[i])) mask[i / 64] &= ~(1ULL << (i % 64));
+}
 
-struct CaseInput {
-  int N;
-  int C;
-};
+void FoldCaseScalar(char* data, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    if (data[i] >= 'A' && data[i] <= 'Z') data[i] += 'a' - 'A';
+}
 
-typedef vector<int> CaseOutput;
+size_t FindOutOfRangeScalar(const int* v, size_t n, int lo, int hi) {
+  size_t i = 0;
+  while (i < n && lo <= v[i] && v[i] <= hi) ++i;
+  return i;
+}
 
-CaseInput ParseCaseInput(istream& in) {
-  int N, C;
-  in >> N >> C;
-  return {
-    .N = N,
-    .C = C
-  };
+size_t MinIndexScalar(const int* v, size_t n) {
+  size_t r = 0;
+  for (size_t i = 1; i < n; ++i)
+    if (v[i] < v[r]) r = i;
+  return r;
 }
 
-const string kImpossibleKeyword = "IMPOSSIBLE";
-const string kBadImpossibleClaimError =
-    "Contestant claims a solution does not exist while judge finds a solution";
-const string kInvalidLengthError =
-    "Solution length does not match the number of elements in the array.";
-const string kInvalidElementsRange = "Output elements should be from 1 to N.";
-const string kDuplicateElementsFound = "Duplicate elements found in the output.";
-const string kWrongInformationError =
-    "Solution does not generate cost C.";
-const CaseOutput kImpossibleOutput = {};
-const string kAccepted = "";
+size_t FindNonTextScalar(const char* data, size_t begin, size_t end) {
+  while (begin < end && ((data[begin] >= ' ' && data[begin] <= '~') ||
+                         IsTokenSpace(data[begin])))
+    ++begin;
+  return begin;
+}
 
-CaseOutput ParseCaseOutput(const vector<vector<string>>& lines) {
-  if (lines.size() != 1) Error("Wrong number of lines in case output");
-  if (lines[0].size() == 0) Error("Case output is empty");
-  if (lines[0] == vector<string>({Lowercase(kImpossibleKeyword)})) {
-    return kImpossibleOutput;
-  }
-  vector<int> output;
-  for (int i = 0; i < lines[0].size(); ++i) {
-    long long x = ParseInt(lines[0][i]);
-    if (INT_MIN <= x && x <= INT_MAX) {
-      output.push_back((int) x);
-    } else {
-      Error("Number is outside signed 32-bit integer range");
-    }
-  }
-  return output;
+size_t FindOutOfToleranceScalar(const double* expected, const double* got,
+                                size_t n, double abs_tol, double rel_tol) {
+  size_t i = 0;
+  while (i < n && WithinTolerance(expected[i], got[i], abs_tol, rel_tol)) ++i;
+  return i;
 }
 
-int solve(CaseOutput v) {
-  int curr_ans = 0;
-  for (int i = 0; i < v.size() - 1; i++) {
-    int mnind = i;
-    for (int j = i + 1; j < v.size(); j++) {
-      if (v[j] < v[mnind]) mnind = j;
-    }
-    curr_ans += mnind - i + 1;
-    reverse(v.begin() + i, v.begin() + mnind + 1);
-  }
-  vector<int> tmp(v);
-  sort(tmp.begin(), tmp.end());
-  return curr_ans;
+size_t CommonFoldedPrefixScalar(const char* a, const char* b, size_t n) {
+  auto fold = [](char c) { return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c; };
+  size_t i = 0;
+  while (i < n && fold(a[i]) == fold(b[i])) ++i;
+  return i;
 }
 
-string JudgeCase(const CaseInput& input, const CaseOutput& correct_output,
-                 const CaseOutput& attempt) {
+#ifdef JUDGE_X86_SIMD
+// The SSE4.2 kernels, for the oldest nodes of the fleet. Only the integer
+// kernels need more than SSE2.
+#define JUDGE_SSE42 __attribute__((target("sse4.2")))
+
+JUDGE_SSE42 size_t FindByteSse42(const char* data, size_t begin, size_t end,
+                                 char c) {
+  const __m128i cs = _mm_set1_epi8(c);
+  for (; begin + 16 <= end; begin += 16) {
+    const unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + begin)), cs));
+    if (m != 0) return begin + __builtin_ctz(m);
+  }
+  return FindByteScalar(data, begin, end, c);
+}
+
+// Bits of the IsTokenSpace bytes of 16 bytes: ' ', or '\t' to '\r', found
+// with a signed compare on bytes shifted so that '\t' is -128.
+JUDGE_SSE42 unsigned SpaceBitsSse42(__m128i x) {
+  const __m128i shifted = _mm_add_epi8(x, _mm_set1_epi8(0x80 - '\t'));
+  return _mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+      _mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + 5))));
+}
+
+JUDGE_SSE42 void SpaceMaskSse42(const char* data, size_t n, uint64_t* mask) {
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t m = 0;
+    for (int k = 0; k < 4; ++k)
+      m |= (uint64_t)SpaceBitsSse42(_mm_loadu_si128(
+               reinterpret_cast<const __m128i*>(data + i + 16 * k)))
+           << (16 * k);
+    mask[i / 64] = m;
+  }
+  SpaceMaskScalar(data + i, n - i, mask + i / 64);
+}
+
+// x with its ASCII uppercase letters lowercased.
+JUDGE_SSE42 __m128i FoldCaseBytesSse42(__m128i x) {
+  const __m128i upper = _mm_cmplt_epi8(
+      _mm_add_epi8(x, _mm_set1_epi8(0x80 - 'A')), _mm_set1_epi8(-128 + 26));
+  return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+JUDGE_SSE42 void FoldCaseSse42(char* data, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i* p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, FoldCaseBytesSse42(_mm_loadu_si128(p)));
+  }
+  FoldCaseScalar(data + i, n - i);
+}
+
+JUDGE_SSE42 size_t FindOutOfRangeSse42(const int* v, size_t n, int lo, int hi) {
+  const __m128i los = _mm_set1_epi32(lo), his = _mm_set1_epi32(hi);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+    const unsigned m = _mm_movemask_ps(_mm_castsi128_ps(
+        _mm_or_si128(_mm_cmplt_epi32(x, los), _mm_cmpgt_epi32(x, his))));
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  return i + FindOutOfRangeScalar(v + i, n - i, lo, hi);
+}
+
+JUDGE_SSE42 size_t MinIndexSse42(const int* v, size_t n) {
+  size_t i = 0;
+  int lowest = INT_MAX;
+  if (n >= 4) {
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v));
+    for (i = 4; i + 4 <= n; i += 4)
+      m = _mm_min_epi32(
+          m, _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    lowest = _mm_cvtsi128_si32(m);
+  }
+  for (; i < n; ++i) lowest = min(lowest, v[i]);
+  const __m128i lowests = _mm_set1_epi32(lowest);
+  for (i = 0; i + 4 <= n; i += 4) {
+    const unsigned m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)), lowests)));
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  while (v[i] != lowest) ++i;
+  return i;
+}
+
+JUDGE_SSE42 size_t FindNonTextSse42(const char* data, size_t begin,
+                                    size_t end) {
+  for (; begin + 16 <= end; begin += 16) {
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + begin));
+    // Bytes of 0x80 and up are negative, so not printable here.
+    const unsigned printable = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(' ' - 1)),
+                      _mm_cmplt_epi8(x, _mm_set1_epi8('~' + 1))));
+    const unsigned m = ~(printable | SpaceBitsSse42(x)) & 0xffff;
+    if (m != 0) return begin + __builtin_ctz(m);
+  }
+  return FindNonTextScalar(data, begin, end);
+}
+
+JUDGE_SSE42 size_t CommonFoldedPrefixSse42(const char* a, const char* b,
+                                           size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const unsigned m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+        FoldCaseBytesSse42(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i))),
+        FoldCaseBytesSse42(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))))) &
+        0xffff;
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  return i + CommonFoldedPrefixScalar(a + i, b + i, n - i);
+}
+
+JUDGE_SSE42 size_t FindOutOfToleranceSse42(const double* expected,
+                                           const double* got, size_t n,
+                                           double abs_tol, double rel_tol) {
+  const __m128d abs_tols = _mm_set1_pd(abs_tol);
+  const __m128d rel_tols = _mm_set1_pd(rel_tol);
+  const __m128d sign = _mm_set1_pd(-0.0);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const __m128d e = _mm_loadu_pd(expected + i);
+    const __m128d diff =
+        _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(got + i), e));
+    const __m128d ok = _mm_or_pd(
+        _mm_cmple_pd(diff, abs_tols),
+        _mm_cmple_pd(diff, _mm_mul_pd(rel_tols, _mm_andnot_pd(sign, e))));
+    const unsigned m = ~_mm_movemask_pd(ok) & 3;
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  return i + FindOutOfToleranceScalar(expected + i, got + i, n - i, abs_tol,
+                                      rel_tol);
+}
+
+#define JUDGE_AVX2 __attribute__((target("avx2")))
+
+JUDGE_AVX2 size_t FindByteAvx2(const char* data, size_t begin, size_t end,
+                               char c) {
+  const __m256i cs = _mm256_set1_epi8(c);
+  for (; begin + 32 <= end; begin += 32) {
+    const unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + begin)),
+        cs));
+    if (m != 0) return begin + __builtin_ctz(m);
+  }
+  return FindByteScalar(data, begin, end, c);
+}
+
+// Like SpaceBitsSse42, for 32 bytes.
+JUDGE_AVX2 unsigned SpaceBitsAvx2(__m256i x) {
+  const __m256i shifted = _mm256_add_epi8(x, _mm256_set1_epi8(0x80 - '\t'));
+  return _mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 5), shifted)));
+}
+
+JUDGE_AVX2 void SpaceMaskAvx2(const char* data, size_t n, uint64_t* mask) {
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    const __m256i* p = reinterpret_cast<const __m256i*>(data + i);
+    mask[i / 64] = SpaceBitsAvx2(_mm256_loadu_si256(p)) |
+                   (uint64_t)SpaceBitsAvx2(_mm256_loadu_si256(p + 1)) << 32;
+  }
+  SpaceMaskScalar(data + i, n - i, mask + i / 64);
+}
+
+// Like FoldCaseBytesSse42, for 32 bytes.
+JUDGE_AVX2 __m256i FoldCaseBytesAvx2(__m256i x) {
+  const __m256i upper =
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26),
+                        _mm256_add_epi8(x, _mm256_set1_epi8(0x80 - 'A')));
+  return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+JUDGE_AVX2 void FoldCaseAvx2(char* data, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, FoldCaseBytesAvx2(_mm256_loadu_si256(p)));
+  }
+  FoldCaseScalar(data + i, n - i);
+}
+
+JUDGE_AVX2 size_t FindOutOfRangeAvx2(const int* v, size_t n, int lo, int hi) {
+  const __m256i los = _mm256_set1_epi32(lo), his = _mm256_set1_epi32(hi);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i x =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+    const unsigned m = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_cmpgt_epi32(los, x), _mm256_cmpgt_epi32(x, his))));
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  return i + FindOutOfRangeScalar(v + i, n - i, lo, hi);
+}
+
+JUDGE_AVX2 size_t MinIndexAvx2(const int* v, size_t n) {
+  if (n < 8) return MinIndexSse42(v, n);
+  size_t i;
+  __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v));
+  for (i = 8; i + 8 <= n; i += 8)
+    m = _mm256_min_epi32(
+        m, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i)));
+  __m128i h = _mm_min_epi32(_mm256_castsi256_si128(m),
+                            _mm256_extracti128_si256(m, 1));
+  h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+  h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+  int lowest = _mm_cvtsi128_si32(h);
+  for (; i < n; ++i) lowest = min(lowest, v[i]);
+  const __m256i lowests = _mm256_set1_epi32(lowest);
+  for (i = 0; i + 8 <= n; i += 8) {
+    const unsigned m = _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i)),
+            lowests)));
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  while (v[i] != lowest) ++i;
+  return i;
+}
+
+JUDGE_AVX2 size_t FindNonTextAvx2(const char* data, size_t begin, size_t end) {
+  for (; begin + 32 <= end; begin += 32) {
+    const __m256i x =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + begin));
+    const unsigned printable = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(' ' - 1)),
+                         _mm256_cmpgt_epi8(_mm256_set1_epi8('~' + 1), x)));
+    const unsigned m = ~(printable | SpaceBitsAvx2(x));
+    if (m != 0) return begin + __builtin_ctz(m);
+  }
+  return FindNonTextScalar(data, begin, end);
+}
+
+JUDGE_AVX2 size_t CommonFoldedPrefixAvx2(const char* a, const char* b,
+                                         size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const unsigned m = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        FoldCaseBytesAvx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i))),
+        FoldCaseBytesAvx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)))));
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  return i + CommonFoldedPrefixScalar(a + i, b + i, n - i);
+}
+
+JUDGE_AVX2 size_t FindOutOfToleranceAvx2(const double* expected,
+                                         const double* got, size_t n,
+                                         double abs_tol, double rel_tol) {
+  const __m256d abs_tols = _mm256_set1_pd(abs_tol);
+  const __m256d rel_tols = _mm256_set1_pd(rel_tol);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d e = _mm256_loadu_pd(expected + i);
+    const __m256d diff =
+        _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(got + i), e));
+    const __m256d ok = _mm256_or_pd(
+        _mm256_cmp_pd(diff, abs_tols, _CMP_LE_OQ),
+        _mm256_cmp_pd(diff, _mm256_mul_pd(rel_tols, _mm256_andnot_pd(sign, e)),
+                      _CMP_LE_OQ));
+    const unsigned m = ~_mm256_movemask_pd(ok) & 15;
+    if (m != 0) return i + __builtin_ctz(m);
+  }
+  return i + FindOutOfToleranceScalar(expected + i, got + i, n - i, abs_tol,
+                                      rel_tol);
+}
+#endif  // JUDGE_X86_SIMD
+
+const SimdKernels kSimdKernels[kNumSimdLevels] = {
+    {"scalar", FindByteScalar, SpaceMaskScalar, FoldCaseScalar,
+     FindOutOfRangeScalar, MinIndexScalar, FindNonTextScalar,
+     CommonFoldedPrefixScalar, FindOutOfToleranceScalar},
+#ifdef JUDGE_X86_SIMD
+    {"sse4.2", FindByteSse42, SpaceMaskSse42, FoldCaseSse42,
+     FindOutOfRangeSse42, MinIndexSse42, FindNonTextSse42,
+     CommonFoldedPrefixSse42, FindOutOfToleranceSse42},
+    {"avx2", FindByteAvx2, SpaceMaskAvx2, FoldCaseAvx2, FindOutOfRangeAvx2,
+     MinIndexAvx2, FindNonTextAvx2, CommonFoldedPrefixAvx2,
+     FindOutOfToleranceAvx2},
+#endif
+};
+
+// The best SIMD level of the CPU this runs on.
+SimdLevel SupportedSimdLevel() {
+#ifdef JUDGE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return kSimdAvx2;
+  if (__builtin_cpu_supports("sse4.2")) return kSimdSse42;
+#endif
+  return kSimdScalar;
+}
+
+// The kernels in use.
+const SimdKernels* simd = &kSimdKernels[SupportedSimdLevel()];
+
+// Uses the kernels of the level named name, such as "sse4.2". Returns false if
+// there is no such level or the CPU does not support it.
+bool SetSimdLevel(const string& name) {
+  for (int level = 0; level <= SupportedSimdLevel(); ++level) {
+    if (name == kSimdKernels[level].name) {
+      simd = &kSimdKernels[level];
+      return true;
+    }
+  }
+  return false;
+}
+
+void ReportSimdKernels(ostream& out) {
+  out << "simd_level: " << simd->name << " (supported: "
+      << kSimdKernels[SupportedSimdLevel()].name << ")" << endl;
+}
+
+void TestSimdKernels() {
+  mt19937 rng(11);
+  const string alphabet =
+      " \t\n\v\f\r\x08\x0e\x1f!#@AZ[`az{~\x7f\x80\xff";
+  for (int level = 0; level <= SupportedSimdLevel(); ++level) {
+    const SimdKernels& k = kSimdKernels[level];
+    const SimdKernels& ref = kSimdKernels[kSimdScalar];
+    for (int t = 0; t < 300; ++t) {
+      string data(rng() % 200, ' ');
+      for (char& c : data) c = alphabet[rng() % alphabet.size()];
+      const size_t begin = rng() % (data.size() + 1);
+      assert(k.find_byte(data.data(), begin, data.size(), '#') ==
+             ref.find_byte(data.data(), begin, data.size(), '#'));
+      // Mostly text, so that runs are long enough for the vector loops.
+      string text = data;
+      for (char& c : text)
+        if (rng() % 8 != 0) c = 'a';
+      assert(k.find_non_text(text.data(), begin, text.size()) ==
+             ref.find_non_text(text.data(), begin, text.size()));
+      string other = text;
+      for (char& c : other) {
+        if (rng() % 4 == 0) c = toupper(c);
+        if (rng() % 300 == 0) c = '#';
+      }
+      assert(k.common_folded_prefix(text.data(), other.data(), text.size()) ==
+             ref.common_folded_prefix(text.data(), other.data(), text.size()));
+      vector<double> expected(rng() % 40), got(expected.size());
+      for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = ((int)(rng() % 2001) - 1000) / 8.0;
+        got[i] = expected[i] + ((int)(rng() % 2001) - 1000) * 1e-9;
+        if (rng() % 50 == 0) got[i] = rng() % 2 ? NAN : -got[i];
+      }
+      assert(k.find_out_of_tolerance(expected.data(), got.data(),
+                                     expected.size(), 1e-7, 1e-9) ==
+             ref.find_out_of_tolerance(expected.data(), got.data(),
+                                       expected.size(), 1e-7, 1e-9));
+      vector<uint64_t> mask(data.size() / 64 + 1), ref_mask(mask.size());
+      k.space_mask(data.data(), data.size(), mask.data());
+      ref.space_mask(data.data(), data.size(), ref_mask.data());
+      assert(mask == ref_mask);
+      string folded = data, ref_folded = data;
+      k.fold_case(&folded[0], folded.size());
+      ref.fold_case(&ref_folded[0], ref_folded.size());
+      assert(folded == ref_folded);
+      vector<int> v(rng() % 40 + 1);
+      for (int& x : v)
+        x = rng() % 30 == 0 ? INT_MIN + (int)(rng() % 50)
+                            : (int)(rng() % 50) - 5;
+      assert(k.find_out_of_range(v.data(), v.size(), 1, 40) ==
+             ref.find_out_of_range(v.data(), v.size(), 1, 40));
+      assert(k.min_index(v.data(), v.size()) ==
+             ref.min_index(v.data(), v.size()));
+    }
+  }
+  assert(kSimdKernels[kSimdScalar].min_index(vector<int>({3, 1, 1}).data(),
+                                             3) == 1);
+  const SimdKernels* saved = simd;
+  assert(SetSimdLevel("scalar") && simd == &kSimdKernels[kSimdScalar]);
+  assert(!SetSimdLevel("avx9000"));
+  simd = saved;
+}
+
+// Index of the first got[i] that is not WithinTolerance of expected[i], or
+// got.size(), for answer vectors of the same size.
+size_t FindOutOfTolerance(const vector<double>& expected,
+                          const vector<double>& got, double abs_tol,
+                          double rel_tol) {
+  return simd->find_out_of_tolerance(expected.data(), got.data(),
+                                     min(expected.size(), got.size()), abs_tol,
+                                     rel_tol);
+}
+
+void TestWithinTolerance() {
+  assert(WithinTolerance(1, 1, 0, 0));
+  assert(WithinTolerance(1, 1 + 1e-7, 1e-6, 0));
+  assert(!WithinTolerance(1, 1 + 1e-5, 1e-6, 0));
+  assert(WithinTolerance(1e9, 1e9 + 100, 1e-6, 1e-6));
+  assert(!WithinTolerance(1e9, 1e9 + 10000, 1e-6, 1e-6));
+  assert(WithinTolerance(-1e9, -1e9 - 100, 0, 1e-6));
+  assert(!WithinTolerance(0, NAN, 1, 1));
+  assert(!WithinTolerance(0, INFINITY, 1, 1));
+  const vector<double> expected = {0, 1, 2, 3, 4, 5};
+  assert(FindOutOfTolerance(expected, expected, 0, 0) == 6);
+  assert(FindOutOfTolerance(expected, {0, 1, 2, 3, 4.5, 5}, 0.1, 0) == 4);
+  assert(FindOutOfTolerance(expected, {0, 1, 2, 3, 4.5, 5}, 0.1, 0.2) == 6);
+}
+
+// Read-only view of a whole file, mapped with mmap. ok() is false if the file
+// cannot be opened or is not a regular file; empty files are valid and have no
+// mapping.
+class MappedFile {
+ public:
+  explicit MappedFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    Map(fd);
+    close(fd);
+  }
+  // Maps the file open as fd, which stays open.
+  explicit MappedFile(int fd) { Map(fd); }
+  ~MappedFile() {
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool ok() const { return ok_; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  string_view view() const { return string_view(data_, ok_ ? size_ : 0); }
+
+ private:
+  void Map(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    size_ = st.st_size;
+    if (size_ == 0) {
+      ok_ = true;
+      return;
+    }
+    void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      data_ = static_cast<const char*>(p);
+      ok_ = true;
+    }
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool ok_ = false;
+};
+
+// A whole file in memory: mapped if possible, and read with ReadAll
+// otherwise, for pipes, sockets and other files that cannot be mapped. "-" is
+// stdin. Missing files are empty.
+class FileContents {
+ public:
+  explicit FileContents(const string& filename)
+      : FileContents(OpenInputFile(filename), true) {}
+  // The contents of the file open as fd, which stays open.
+  explicit FileContents(int fd) : FileContents(fd, false) {}
+  FileContents(const FileContents&) = delete;
+  FileContents& operator=(const FileContents&) = delete;
+
+  string_view view() const { return view_; }
+  // Whether the file could be opened.
+  bool ok() const { return ok_; }
+
+ private:
+  FileContents(int fd, bool close_fd) : mapped_(fd), ok_(fd >= 0) {
+    if (mapped_.ok()) {
+      view_ = mapped_.view();
+    } else if (fd >= 0) {
+      read_ = ReadAll(fd);
+      view_ = read_;
+    }
+    if (close_fd && fd >= 0) close(fd);
+  }
+
+  MappedFile mapped_;
+  string read_;
+  string_view view_;
+  bool ok_;
+};
+
+// Whether the line starting at data[begin] is a case header candidate, that
+// is, its first token is "case" in any letter case and its second starts with
+// '#'. SplitCases turns every candidate into a case or raises an error. Takes
+// any bytes, including ones that are not ASCII.
+bool IsCaseHeaderLine(string_view data, size_t begin) {
+  auto is_space = [](char c) { return c != '\n' && IsTokenSpace(c); };
+  size_t i = begin;
+  while (i < data.size() && is_space(data[i])) ++i;
+  if (data.size() - i < 4) return false;
+  for (int k = 0; k < 4; ++k)
+    if (tolower((unsigned char)data[i + k]) != "case"[k]) return false;
+  i += 4;
+  if (i == data.size() || !is_space(data[i])) return false;
+  while (i < data.size() && is_space(data[i])) ++i;
+  return i < data.size() && data[i] == '#';
+}
+
+// Byte offsets of the case header lines of a file, checking every line.
+vector<size_t> FindCaseHeadersByLine(string_view data) {
+  vector<size_t> r;
+  for (size_t begin = 0; begin < data.size();) {
+    if (IsCaseHeaderLine(data, begin)) r.push_back(begin);
+    const size_t end = data.find('\n', begin);
+    if (end == string_view::npos) break;
+    begin = end + 1;
+  }
+  return r;
+}
+
+// If the '#' at data[hash] starts the second token of a case header line,
+// the offset of that line; otherwise string_view::npos. Only looks back from
+// hash, over at most the whitespace and "case" before it.
+size_t CaseHeaderLineOf(string_view data, size_t hash) {
+  auto is_space = [](char c) { return c != '\n' && IsTokenSpace(c); };
+  size_t i = hash;
+  while (i > 0 && is_space(data[i - 1])) --i;
+  if (i == hash || i < 4) return string_view::npos;
+  for (int k = 0; k < 4; ++k)
+    if (tolower((unsigned char)data[i - 4 + k]) != "case"[k])
+      return string_view::npos;
+  i -= 4;
+  while (i > 0 && is_space(data[i - 1])) --i;
+  if (i > 0 && data[i - 1] != '\n') return string_view::npos;
+  return i;
+}
+
+// Byte offsets of the case header lines of a file. Instead of looking at every
+// line, it finds the '#' bytes with simd->find_byte and checks the few that
+// follow "case".
+vector<size_t> FindCaseHeaders(string_view data) {
+  vector<size_t> r;
+  for (size_t i = simd->find_byte(data.data(), 0, data.size(), '#');
+       i < data.size();
+       i = simd->find_byte(data.data(), i + 1, data.size(), '#')) {
+    const size_t line = CaseHeaderLineOf(data, i);
+    if (line != string_view::npos) r.push_back(line);
+  }
+  return r;
+}
+
+void TestFindCaseHeaders() {
+  assert(Eq(FindCaseHeaders(""), {}));
+  assert(Eq(FindCaseHeaders("Case #1: a\n  CASE\t#2:\nx\ncase #3"),
+            {0, 11, 24}));
+  assert(Eq(FindCaseHeaders("case#1: a\ncases #2\ncase\n#3\nx case #4\n"),
+            {}));
+  assert(Eq(FindCaseHeaders("\ncase # 1\ncase #"), {1, 10}));
+  assert(Eq(FindCaseHeaders(" \t Case\v\f#x\n#case #\ncase ##"), {0, 20}));
+  mt19937 rng(7);
+  const string alphabet = "caseCASE #\t\n\r:1x\xa0\xc3\xff";
+  for (int t = 0; t < 2000; ++t) {
+    string data(rng() % 80, ' ');
+    for (char& c : data) c = alphabet[rng() % alphabet.size()];
+    assert(Eq(FindCaseHeaders(data), FindCaseHeadersByLine(data)));
+  }
+}
+
+// Tokens of a file split into cases, in compressed sparse row form: the
+// lowercased bytes of all tokens back to back, with token i spanning
+// bytes[token_begin[i], token_begin[i + 1]), line j tokens
+// [line_begin[j], line_begin[j + 1]) and case k lines
+// [case_begin[k], case_begin[k + 1]). Case header tokens are not kept.
+struct TokenTable {
+  string bytes;
+  vector<size_t> token_begin = {0};
+  vector<size_t> line_begin = {0};
+  vector<size_t> case_begin = {0};
+
+  size_t num_cases() const { return case_begin.size() - 1; }
+  // Empties the table, keeping its memory for the next cases.
+  void clear() {
+    bytes.clear();
+    token_begin.resize(1);
+    line_begin.resize(1);
+    case_begin.resize(1);
+  }
+};
+
+// View of the tokens of one line of a TokenTable.
+class TokenLine {
+ public:
+  TokenLine(const TokenTable& table, size_t line)
+      : table_(&table),
+        first_(table.line_begin[line]),
+        size_(table.line_begin[line + 1] - first_) {}
+
+  size_t size() const { return size_; }
+  string_view operator[](size_t i) const {
+    const size_t begin = table_->token_begin[first_ + i];
+    return string_view(table_->bytes.data() + begin,
+                       table_->token_begin[first_ + i + 1] - begin);
+  }
+
+ private:
+  const TokenTable* table_;
+  size_t first_;
+  size_t size_;
+};
+
+// View of the lines of one case of a TokenTable, indexed like the
+// vector<vector<string>> that SplitCases returns for a case.
+class TokenCase {
+ public:
+  TokenCase(const TokenTable& table, size_t case_index)
+      : table_(&table),
+        first_(table.case_begin[case_index]),
+        size_(table.case_begin[case_index + 1] - first_) {}
+
+  size_t size() const { return size_; }
+  TokenLine operator[](size_t j) const { return TokenLine(*table_, first_ + j); }
+
+  // A copy of the case's tokens, for parsers that take them as strings.
+  vector<vector<string>> ToLines() const {
+    vector<vector<string>> r(size_);
+    for (size_t j = 0; j < size_; ++j) {
+      const TokenLine line = (*this)[j];
+      for (size_t i = 0; i < line.size(); ++i) r[j].emplace_back(line[i]);
+    }
+    return r;
+  }
+
+ private:
+  const TokenTable* table_;
+  size_t first_;
+  size_t size_;
+};
+
+// The first token in data[*pos, end), advancing *pos past it, or an empty view
+// if there is none.
+string_view NextToken(string_view data, size_t* pos, size_t end) {
+  while (*pos < end && IsTokenSpace(data[*pos])) ++*pos;
+  const size_t begin = *pos;
+  while (*pos < end && !IsTokenSpace(data[*pos])) ++*pos;
+  return data.substr(begin, *pos - begin);
+}
+
+void AppendLowercase(string_view token, string* out) {
+  const size_t begin = out->size();
+  out->append(token.data(), token.size());
+  for (size_t i = begin; i < out->size(); ++i)
+    if ((*out)[i] >= 'A' && (*out)[i] <= 'Z') (*out)[i] += 'a' - 'A';
+}
+
+// Length of the well-formed UTF-8 sequence of a non-ASCII character at
+// data[i], or 0 if there is none. Overlong forms, surrogates and code points
+// past U+10FFFF are not well-formed.
+size_t Utf8SequenceLength(string_view data, size_t i) {
+  const unsigned char lead = data[i];
+  size_t n;
+  unsigned char lo = 0x80, hi = 0xbf;  // Range of the second byte.
+  if (lead >= 0xc2 && lead <= 0xdf) {
+    n = 2;
+  } else if (lead >= 0xe0 && lead <= 0xef) {
+    n = 3;
+    if (lead == 0xe0) lo = 0xa0;
+    if (lead == 0xed) hi = 0x9f;
+  } else if (lead >= 0xf0 && lead <= 0xf4) {
+    n = 4;
+    if (lead == 0xf0) lo = 0x90;
+    if (lead == 0xf4) hi = 0x8f;
+  } else {
+    return 0;
+  }
+  if (data.size() - i < n) return 0;
+  for (size_t k = 1; k < n; ++k) {
+    const unsigned char c = data[i + k];
+    if (c < (k == 1 ? lo : 0x80) || c > (k == 1 ? hi : 0xbf)) return 0;
+  }
+  return n;
+}
+
+// Checks that data[begin, end) is text: printable ASCII, whitespace and
+// well-formed UTF-8, so that binary garbage is rejected before any per-token
+// work. Raises Error on the first other byte, numbering lines from
+// first_line, the line of data[0].
+void CheckOutputText(string_view data, size_t begin, size_t end,
+                     long long first_line = 1) {
+  for (size_t i = simd->find_non_text(data.data(), begin, end); i < end;
+       i = simd->find_non_text(data.data(), i, end)) {
+    const size_t n = Utf8SequenceLength(data.substr(0, end), i);
+    if (n == 0) {
+      Error(Diagnostic{kInvalidOutputByte, "", (unsigned char)data[i], 0,
+                       first_line +
+                           count(data.begin(), data.begin() + i, '\n')});
+      return;
+    }
+    i += n;
+  }
+}
+
+void CheckOutputText(string_view data) {
+  CheckOutputText(data, 0, data.size());
+}
+
+void TestCheckOutputText() {
+  for (const string text :
+       {"", "Case #1: 1 2\r\n\tIMPOSSIBLE\v\f~", "caf\xc3\xa9 \xe2\x82\xac",
+        "\xf0\x9f\x98\x80\xf4\x8f\xbf\xbf\xed\x9f\xbf\xe0\xa0\x80"}) {
+    CheckOutputText(text);
+  }
+  const vector<pair<string, string>> bad = {
+      {string("a\0", 2), "0x00 in output on line 1"},
+      {"\n\n\x7f", "0x7F in output on line 3"},
+      {"a\n\x1b[0m", "0x1B in output on line 2"},
+      {"\xc3", "0xC3 in output on line 1"},
+      {"\xc3" "A", "0xC3 in output on line 1"},
+      {"\xc0\x80", "0xC0 in output on line 1"},
+      {"\xe0\x80\x80", "0xE0 in output on line 1"},
+      {"\xed\xa0\x80", "0xED in output on line 1"},
+      {"\xf4\x90\x80\x80", "0xF4 in output on line 1"},
+      {"\xf5\x80\x80\x80", "0xF5 in output on line 1"},
+      {"ok \xc3\xa9\x80", "0x80 in output on line 1"},
+      {string(100, 'x') + "\n" + string(100, ' ') + "\xff",
+       "0xFF in output on line 2"},
+  };
+  for (const auto& b : bad) {
+    AssertError(CheckOutputText(b.first), "Invalid byte " + b.second);
+  }
+  // Only the given range is checked.
+  CheckOutputText("\xff ok \xff", 1, 5);
+  AssertError(CheckOutputText("\n\xff", 0, 2, 7),
+              "Invalid byte 0xFF in output on line 8");
+}
+
+// Checks that the case header line at data[header] is numbered case_number.
+// Returns where the tokens of its case start, after the header's two tokens,
+// or raises Error.
+size_t CheckCaseHeader(string_view data, size_t header, long long case_number) {
+  size_t pos = header;
+  const size_t end = min(data.find('\n', pos), data.size());
+  NextToken(data, &pos, end);
+  const string_view second = NextToken(data, &pos, end);
+  if (second.size() < 3 || second.back() != ':') {
+    Error(Diagnostic{kBadCaseLine});
+    return pos;
+  }
+  string case_num;
+  AppendLowercase(second.substr(1, second.size() - 2), &case_num);
+  const long long n = ParseInt(case_num);
+  if (Failed()) return pos;
+  if (n != case_number)
+    Error(Diagnostic{kUnexpectedCaseNumber, case_num, 0, case_number});
+  return pos;
+}
+
+// Checks that only whitespace precedes the first of headers, the case header
+// lines of data, and that the headers are numbered from first_case. Returns
+// where the tokens of each case start, or raises Error and returns nothing.
+vector<size_t> CheckCaseHeaders(string_view data, const vector<size_t>& headers,
+                                long long first_case) {
+  size_t pos = 0;
+  if (!NextToken(data, &pos, headers.empty() ? data.size() : headers[0])
+           .empty()) {
+    Error(Diagnostic{kFirstLineNotCase});
+    return {};
+  }
+  vector<size_t> bodies(headers.size());
+  for (size_t k = 0; k < headers.size(); ++k) {
+    CheckDeadline();
+    if (Failed()) return {};
+    bodies[k] = CheckCaseHeader(data, headers[k], (long long)k + first_case);
+    if (Failed()) return {};
+  }
+  return bodies;
+}
+
+// Offset of the first bit equal to bit in bits[i, end) of a bitmap, or end.
+size_t FindBit(const uint64_t* bits, size_t i, size_t end, bool bit) {
+  while (i < end) {
+    const uint64_t word =
+        (bit ? bits[i / 64] : ~bits[i / 64]) & (~0ULL << (i % 64));
+    if (word != 0) return min(end, i / 64 * 64 + __builtin_ctzll(word));
+    i = (i / 64 + 1) * 64;
+  }
+  return end;
+}
+
+// Appends the case whose tokens are data[body, case_end) to table. Token
+// boundaries come from a bitmap of the whitespace of the case, and the
+// tokens are lowercased together at the end.
+void AppendCaseTokens(string_view data, size_t body, size_t case_end,
+                      TokenTable* table) {
+  const char* d = data.data() + body;
+  const size_t n = case_end - body;
+  thread_local vector<uint64_t> spaces;
+  spaces.resize(n / 64 + 1);
+  simd->space_mask(d, n, spaces.data());
+  const size_t first_byte = table->bytes.size();
+  table->case_begin.push_back(table->case_begin.back());
+  // The header line is a line of the case even if nothing follows the
+  // header; other lines only if they have tokens.
+  bool header_line = true;
+  for (size_t begin = 0; header_line || begin < n;) {
+    CheckDeadline();
+    if (Failed()) return;
+    const size_t end = min(data.find('\n', body + begin), case_end) - body;
+    const size_t num_tokens = table->token_begin.size();
+    for (size_t pos = FindBit(spaces.data(), begin, end, false); pos < end;
+         pos = FindBit(spaces.data(), pos, end, false)) {
+      const size_t token_end = FindBit(spaces.data(), pos, end, true);
+      table->bytes.append(d + pos, token_end - pos);
+      table->token_begin.push_back(table->bytes.size());
+      pos = token_end;
+    }
+    if (header_line || table->token_begin.size() > num_tokens) {
+      table->line_begin.push_back(table->token_begin.size() - 1);
+      ++table->case_begin.back();
+    }
+    header_line = false;
+    begin = end + 1;
+  }
+  simd->fold_case(&table->bytes[0] + first_byte,
+                  table->bytes.size() - first_byte);
+}
+
+// Appends cases [first, last) of data to table, given the headers and bodies
+// that CheckCaseHeaders checked.
+void AppendCaseTokens(string_view data, const vector<size_t>& headers,
+                      const vector<size_t>& bodies, size_t first, size_t last,
+                      TokenTable* table) {
+  for (size_t k = first; k < last && !Failed(); ++k)
+    AppendCaseTokens(data, bodies[k],
+                     k + 1 < headers.size() ? headers[k + 1] : data.size(),
+                     table);
+}
+
+// Appends the cases of src to table, shifting src's offsets past table's.
+void AppendTokenTable(const TokenTable& src, TokenTable* table) {
+  const size_t bytes = table->bytes.size();
+  const size_t tokens = table->token_begin.size() - 1;
+  const size_t lines = table->line_begin.size() - 1;
+  table->bytes += src.bytes;
+  for (size_t i = 1; i < src.token_begin.size(); ++i)
+    table->token_begin.push_back(src.token_begin[i] + bytes);
+  for (size_t i = 1; i < src.line_begin.size(); ++i)
+    table->line_begin.push_back(src.line_begin[i] + tokens);
+  for (size_t i = 1; i < src.case_begin.size(); ++i)
+    table->case_begin.push_back(src.case_begin[i] + lines);
+}
+
+// Tokenizes data into cases like SplitCases(TokenizeLines(data), first_case),
+// raising the same errors, but without a string per token. Case boundaries
+// come from FindCaseHeaders, and the headers are checked before anything is
+// tokenized. With num_threads > 1 the cases are split into that many chunks
+// of about the same size, tokenized on their own threads into their own
+// tables and appended in order; a header always starts a chunk, so no token
+// or line crosses one. The threads share what is left of the calling thread's
+// CPU deadline in a CpuPool.
+TokenTable TokenizeCases(string_view data, long long first_case = 1,
+                         int num_threads = 1) {
+  const vector<size_t> headers = FindCaseHeaders(data);
+  const vector<size_t> bodies = CheckCaseHeaders(data, headers, first_case);
+  if (Failed()) return TokenTable();
+  // Chunk i is cases [chunk_begin[i], chunk_begin[i + 1]).
+  vector<size_t> chunk_begin = {0};
+  for (int i = 1; i < num_threads; ++i)
+    chunk_begin.push_back(
+        lower_bound(headers.begin(), headers.end(),
+                    data.size() / num_threads * i) - headers.begin());
+  chunk_begin.push_back(headers.size());
+  vector<TokenTable> chunks(num_threads);
+  vector<string> errors(num_threads);
+  CpuPool pool;
+  vector<thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    if (chunk_begin[i] == chunk_begin[i + 1]) continue;
+    threads.emplace_back([&, i] {
+      CpuPool::Helper helper(pool);
+      CatchError(
+          [&] {
+            AppendCaseTokens(data, headers, bodies, chunk_begin[i],
+                             chunk_begin[i + 1], &chunks[i]);
+          },
+          &errors[i]);
+    });
+  }
+  TokenTable table;
+  table.bytes.reserve(data.size());
+  AppendCaseTokens(data, headers, bodies, 0, chunk_begin[1], &table);
+  for (thread& t : threads) t.join();
+  CheckDeadline();
+  if (Failed()) return TokenTable();
+  for (int i = 1; i < num_threads; ++i) {
+    if (!errors[i].empty()) {
+      Error(errors[i]);
+      return TokenTable();
+    }
+    AppendTokenTable(chunks[i], &table);
+  }
+  return table;
+}
+
+// Files smaller than this are not worth a thread per chunk.
+const size_t kMinTokenizeChunkBytes = 4 << 20;
+
+// Threads TokenizeCases may use when parsing a whole attempt. Set from
+// --threads when judging a single attempt; batch mode already judges
+// attempts in parallel and leaves it at 1.
+int tokenize_threads = 1;
+
+// Threads worth using to tokenize size bytes.
+int TokenizeThreadsFor(size_t size) {
+  return (int)max<size_t>(
+      1, min<size_t>(tokenize_threads, size / kMinTokenizeChunkBytes));
+}
+
+// Views of every case of a TokenTable, as vectors of token strings.
+vector<vector<vector<string>>> TokenTableCases(const TokenTable& table) {
+  vector<vector<vector<string>>> r;
+  for (size_t k = 0; k < table.num_cases(); ++k)
+    r.push_back(TokenCase(table, k).ToLines());
+  return r;
+}
+
+void TestTokenizeCases() {
+  const vector<string> files = {
+      "",
+      "\n \n",
+      "Case #1: A b\n\n c\r\nCASE #2:\ncase #3: x\n",
+      "case #1:x",
+      "Case #1: 1\n2 3\nCase #2: 4",
+      "x\nCase #1: 1",
+      "Case #1: 1\nCase #3: 1",
+      "Case #1: 1\nCase #Two: 1",
+      "Case #1: 1\nCase #2 : 1",
+      "Case #1: a\n case #02: b\tc\vd\fe",
+      string("Case #1: a\0b\n", 14),
+      "Cases #1: 1",
+      "Case #" + string(60, '9') + ": 1",
+      "Case\t#1:\t\xe9Z\n",
+  };
+  for (const string& file : files) {
+    string expected_error, error;
+    vector<vector<vector<string>>> expected;
+    TokenTable table;
+    const bool expected_ok = CatchError(
+        [&] { expected = SplitCases(TokenizeLines(file)); }, &expected_error);
+    for (int threads = 1; threads <= 4; ++threads) {
+      const bool ok = CatchError(
+          [&] { table = TokenizeCases(file, 1, threads); }, &error);
+      assert(ok == expected_ok);
+      assert(Eq(error, expected_error));
+      if (ok) assert(Eq(TokenTableCases(table), expected));
+    }
+  }
+  const TokenTable table = TokenizeCases("Case #3: a\ncase #4: b C\nd", 3);
+  assert(table.num_cases() == 2);
+  const TokenCase second(table, 1);
+  assert(second.size() == 2 && second[0].size() == 2 && second[0][1] == "c");
+  assert(second[1][0] == "d");
+  // Tokenizing on four threads takes as much CPU time in all as on one, so
+  // it fails a deadline of half that time.
+  string big;
+  for (int k = 1; k <= 20000; ++k) {
+    big += "Case #" + Strint(k) + ":";
+    for (int j = 0; j < 100; ++j) big += " ab";
+    big += "\n";
+  }
+  const int64_t start_ns = JudgeCpuTimeNs();
+  TokenizeCases(big, 1, 4);
+  const int64_t cost_ns = JudgeCpuTimeNs() - start_ns;
+  ScopedDeadline deadline(cost_ns / 2);
+  AssertError(TokenizeCases(big, 1, 4), kJudgeTimeLimitError);
+}
+
+// Reads the cases of an output file one at a time, holding only the current
+// case and a chunk of what follows in memory, so that files larger than memory
+// can be judged. Each case is checked like TokenizeCases checks it, after
+// CheckOutputText, and errors are raised in file order: a case is returned
+// only if it and everything before it are valid. "-" is stdin, and missing
+// files are empty.
+class CaseReader {
+ public:
+  explicit CaseReader(const string& filename,
+                      size_t chunk_size = kReadBlockBytes)
+      : CaseReader(OpenInputFile(filename), chunk_size) {}
+  // Reads the file open as fd, such as a pipe, and closes it.
+  explicit CaseReader(int fd, size_t chunk_size = kReadBlockBytes)
+      : fd_(fd), chunk_size_(chunk_size) {
+    eof_ = fd_ < 0;
+  }
+  ~CaseReader() {
+    if (fd_ >= 0) close(fd_);
+  }
+  CaseReader(const CaseReader&) = delete;
+  CaseReader& operator=(const CaseReader&) = delete;
+
+  // Reads the next case into *case_text, from its header line up to the next
+  // header or the end of the file, and sets *body to where its tokens start
+  // after the header. The text is valid until the next call. Returns false
+  // at the end of the file or if an error was raised.
+  bool Next(string_view* case_text, size_t* body) {
+    if (Failed()) return false;
+    for (;;) {
+      CheckDeadline();
+      if (Failed()) return false;
+      const size_t next = FindHeader();
+      if (next == string_view::npos && !eof_) {
+        if (!started_) SkipPrefix(buffer_.rfind('\n') + 1);
+        Fill();
+        continue;
+      }
+      const size_t end = next == string_view::npos ? buffer_.size() : next;
+      if (!started_) {
+        SkipPrefix(end);
+        if (Failed() || next == string_view::npos) return false;
+        started_ = true;
+        continue;
+      }
+      if (pos_ == end) return false;
+      *case_text = string_view(buffer_).substr(pos_, end - pos_);
+      pos_ = end;
+      CheckOutputText(*case_text, 0, case_text->size(), line_);
+      if (Failed()) return false;
+      line_ += count(case_text->begin(), case_text->end(), '\n');
+      *body = CheckCaseHeader(*case_text, 0, ++num_cases_);
+      return !Failed();
+    }
+  }
+
+  // Cases returned so far.
+  size_t num_cases() const { return num_cases_; }
+
+  // For files still being written: at the end of the file, waits for more
+  // while writing() is true, polling every kFollowPollUs.
+  void Follow(function<bool()> writing) { writing_ = move(writing); }
+
+  static const int kFollowPollUs = 1000;
+
+ private:
+  // Offset in buffer_ of the first case header line past the current one, or
+  // string_view::npos if there is none in the buffer yet. Each '#' is looked
+  // at once, across calls.
+  size_t FindHeader() {
+    for (; scan_ < buffer_.size(); ++scan_) {
+      scan_ = simd->find_byte(buffer_.data(), scan_, buffer_.size(), '#');
+      if (scan_ == buffer_.size()) break;
+      const size_t line = CaseHeaderLineOf(buffer_, scan_);
+      if (line != string_view::npos && (line > pos_ || !started_)) {
+        ++scan_;
+        return line;
+      }
+    }
+    return string_view::npos;
+  }
+
+  // Checks that buffer_[pos_, end), before the first case, has no tokens,
+  // and moves past it.
+  void SkipPrefix(size_t end) {
+    if (end <= pos_) return;
+    const string_view prefix = string_view(buffer_).substr(pos_, end - pos_);
+    CheckOutputText(prefix, 0, prefix.size(), line_);
+    if (Failed()) return;
+    size_t i = 0;
+    if (!NextToken(prefix, &i, prefix.size()).empty()) {
+      Error(Diagnostic{kFirstLineNotCase});
+      return;
+    }
+    line_ += count(prefix.begin(), prefix.end(), '\n');
+    pos_ = end;
+  }
+
+  // Drops what was read before pos_ and appends the next chunk of the file.
+  void Fill() {
+    buffer_.erase(0, pos_);
+    scan_ -= pos_;
+    pos_ = 0;
+    const size_t size = buffer_.size();
+    buffer_.resize(size + chunk_size_);
+    ssize_t n;
+    do {
+      n = read(fd_, &buffer_[size], chunk_size_);
+    } while (n < 0 && errno == EINTR);
+    buffer_.resize(size + max<ssize_t>(n, 0));
+    if (n == 0 && writing_) {
+      // Once the writer is done, one more read takes what it wrote last.
+      if (writing_())
+        usleep(kFollowPollUs);
+      else
+        writing_ = nullptr;
+      return;
+    }
+    if (n <= 0) eof_ = true;
+  }
+
+  const int fd_;
+  const size_t chunk_size_;
+  string buffer_;
+  size_t pos_ = 0;   // Start of the current case, or of what is unchecked.
+  size_t scan_ = 0;  // Where FindHeader resumes.
+  bool eof_ = false;
+  bool started_ = false;  // Whether the first header was found.
+  long long line_ = 1;    // Line of buffer_[pos_].
+  long long num_cases_ = 0;
+  function<bool()> writing_;
+};
+
+void TestCaseReader() {
+  const string filename = "/tmp/judge_case_reader_test_" + Strint(getpid());
+  const vector<string> files = {
+      "",
+      "\n \n",
+      "Case #1: A b\n\n c\r\nCASE #2:\ncase #3: x\n",
+      "case #1:x",
+      "Case #1: 1\n2 3\nCase #2: 4",
+      "x\nCase #1: 1",
+      "\n\n  x\n\n",
+      "\n\xff\nCase #1: 1",
+      "Case #1: 1\nCase #3: 1",
+      "Case #1: 1\nCase #Two: 1",
+      "Case #1: 1\nCase #2 : 1",
+      "Case #1: a\n case #02: b\tc\vd\fe",
+      "Case #1: 1 #2\nCase #2: #3 case #3:\n#4\ncase\t#3:",
+      string("Case #1: a\n\nCase #2: a\0b\n", 26),
+      "Cases #1: 1",
+      "Case #" + string(60, '9') + ": 1",
+      "Case\t#1:\t\xe9Z\n",
+  };
+  for (const string& file : files) {
+    ofstream(filename) << file;
+    string expected_error, error;
+    TokenTable expected;
+    const bool expected_ok = CatchError(
+        [&] {
+          CheckOutputText(file);
+          expected = TokenizeCases(file);
+        },
+        &expected_error);
+    for (size_t chunk_size : {1, 2, 3, 7, 64}) {
+      TokenTable table;
+      const bool ok = CatchError(
+          [&] {
+            CaseReader reader(filename, chunk_size);
+            string_view text;
+            size_t body;
+            while (reader.Next(&text, &body)) {
+              AppendCaseTokens(text, body, text.size(), &table);
+              assert(reader.num_cases() == table.num_cases());
+            }
+          },
+          &error);
+      assert(ok == expected_ok);
+      assert(Eq(error, expected_error));
+      if (ok) assert(Eq(TokenTableCases(table), TokenTableCases(expected)));
+    }
+  }
+  int fds[2];
+  assert(pipe(fds) == 0);
+  assert(write(fds[1], "Case #1: a\nCase #2: b", 21) == 21);
+  close(fds[1]);
+  CaseReader pipe_reader(fds[0], 4);
+  string_view text;
+  size_t body;
+  assert(pipe_reader.Next(&text, &body) && text == "Case #1: a\n");
+  assert(pipe_reader.Next(&text, &body) && text == "Case #2: b");
+  assert(!pipe_reader.Next(&text, &body));
+  remove(filename.c_str());
+  CaseReader missing(filename);
+  assert(!missing.Next(&text, &body) && missing.num_cases() == 0);
+}
+
+template <typename ParseCaseInputF>
+auto ParseAllInputFrom(istream& in, ParseCaseInputF ParseCaseInput)
+    -> vector<typename decay<decltype(ParseCaseInput(in))>::type> {
+  int t;
+  in >> t;
+  vector<typename decay<decltype(ParseCaseInput(in))>::type> v(t);
+  for (int i = 0; i < t; ++i) {
+    v[i] = ParseCaseInput(in);
+    if (Failed()) return {};
+  }
+  return v;
+}
+
+template <typename T>
+vector<T> ParseAllInputFrom(istream& in, T ParseCaseInputF(istream&)) {
+  return ParseAllInputFrom<T (*)(istream&)>(in, ParseCaseInputF);
+}
+
+template <typename T>
+vector<T> ParseAllInput(const string& filename, T ParseCaseInputF(istream&)) {
+  ifstream in(filename);
+  return ParseAllInputFrom(in, ParseCaseInputF);
+}
+
+// Parses a case with ParseCaseOutputF, on its token views if it takes a
+// TokenCase and on a copy of its tokens otherwise.
+template <typename ParseCaseOutputF>
+auto ParseTokenCase(ParseCaseOutputF& ParseCaseOutput, const TokenCase& lines) {
+  if constexpr (is_invocable<ParseCaseOutputF&, const TokenCase&>::value)
+    return ParseCaseOutput(lines);
+  else
+    return ParseCaseOutput(lines.ToLines());
+}
+
+// Type of a case output parsed by ParseCaseOutputF from the case's lines.
+template <typename ParseCaseOutputF>
+using ParsedCaseOutput = typename decay<decltype(ParseTokenCase(
+    declval<ParseCaseOutputF&>(), declval<const TokenCase&>()))>::type;
+
+// Parses every case of an output file, or raises Error and returns no cases.
+template <typename ParseCaseOutputF>
+vector<ParsedCaseOutput<ParseCaseOutputF>> ParseAllOutput(
+    const FileContents& file, ParseCaseOutputF ParseCaseOutput) {
+  CheckOutputText(file.view());
+  if (Failed()) return {};
+  const TokenTable table =
+      TokenizeCases(file.view(), 1, TokenizeThreadsFor(file.view().size()));
+  if (Failed()) return {};
+  vector<ParsedCaseOutput<ParseCaseOutputF>> v(table.num_cases());
+  for (size_t i = 0; i < table.num_cases(); ++i) {
+    CheckDeadline();
+    if (Failed()) return {};
+    v[i] = ParseTokenCase(ParseCaseOutput, TokenCase(table, i));
+    if (Failed()) return {};
+  }
+  return v;
+}
+
+// Like the above for the file named filename, or stdin for "-".
+template <typename ParseCaseOutputF>
+vector<ParsedCaseOutput<ParseCaseOutputF>> ParseAllOutput(
+    const string& filename, ParseCaseOutputF ParseCaseOutput) {
+  return ParseAllOutput(FileContents(filename), ParseCaseOutput);
+}
+
+// Like the above for the file open as fd, such as a pipe or a socket.
+template <typename ParseCaseOutputF>
+vector<ParsedCaseOutput<ParseCaseOutputF>> ParseAllOutput(
+    int fd, ParseCaseOutputF ParseCaseOutput) {
+  return ParseAllOutput(FileContents(fd), ParseCaseOutput);
+}
+
+void CheckNumberOfCases(size_t attempt_cases, size_t input_cases) {
+  if (attempt_cases != input_cases)
+    Error(Diagnostic{kWrongNumberOfCases, "", (long long)attempt_cases,
+                     (long long)input_cases});
+}
+
+// Kind of rejection of a case: a stable name for machines, and the message
+// for people. Problems define one constant per kind.
+struct VerdictKind {
+  const char* name;
+  const char* message;
+};
+
+// Verdict of one case: accepted, or a kind of rejection, optionally with the
+// expected and the attempted values. Judging a case with it does not allocate;
+// messages are only rendered at the edge.
+struct CaseVerdict {
+  const VerdictKind* kind = nullptr;  // nullptr if accepted.
+  bool has_details = false;
+  long long expected = 0;
+  long long got = 0;
+
+  bool accepted() const { return kind == nullptr; }
+};
+
+CaseVerdict Reject(const VerdictKind& kind) {
+  CaseVerdict v;
+  v.kind = &kind;
+  return v;
+}
+
+CaseVerdict Reject(const VerdictKind& kind, long long expected, long long got) {
+  CaseVerdict v = Reject(kind);
+  v.has_details = true;
+  v.expected = expected;
+  v.got = got;
+  return v;
+}
+
+// Case verdicts can also be plain messages, "" if accepted.
+bool IsAccepted(const string& verdict) { return verdict.empty(); }
+bool IsAccepted(const CaseVerdict& verdict) { return verdict.accepted(); }
+const string& RenderCaseVerdict(const string& verdict) { return verdict; }
+string RenderCaseVerdict(const CaseVerdict& verdict) {
+  return verdict.accepted() ? "" : verdict.kind->message;
+}
+
+// Message of an attempt rejected on case case_index.
+string RenderRejectedCase(size_t case_index, const string& message) {
+  return "Case #" + Strint(case_index + 1) + ": " + message;
+}
+
+// Judges cases *next_case, *next_case + 1, ... up to num_cases with
+// judge_case(i), which returns the verdict of case i, until one is rejected.
+// Before each case it asks should_yield() whether to stop at that boundary,
+// leaving *next_case there so that a later call resumes. Returns false if it
+// yielded, and otherwise true with the rejected case at *next_case and its
+// verdict in verdict, or an accepted verdict if there is none or an error was
+// raised. Each case runs under case_cpu_budget_ns.
+template <typename JudgeCaseF, typename ShouldYieldF, typename V>
+bool JudgeCasesUntilRejected(size_t num_cases, JudgeCaseF judge_case,
+                             ShouldYieldF should_yield, size_t* next_case,
+                             V* verdict) {
+  for (; *next_case < num_cases; ++*next_case) {
+    if (should_yield()) return false;
+    {
+      ScopedDeadline case_deadline(case_cpu_budget_ns);
+      CheckDeadline();
+      if (!Failed()) *verdict = judge_case(*next_case);
+      CheckDeadline();
+    }
+    if (Failed()) break;
+    if (!IsAccepted(*verdict)) return true;
+  }
+  *verdict = V();
+  return true;
+}
+
+// Like JudgeCasesUntilRejected, rendering the rejected case's message, or ""
+// if there is none, in verdict.
+template <typename JudgeCaseF, typename ShouldYieldF>
+bool JudgeCasesFrom(size_t num_cases, JudgeCaseF judge_case,
+                    ShouldYieldF should_yield, size_t* next_case,
+                    string* verdict) {
+  typename decay<decltype(judge_case(*next_case))>::type case_verdict;
+  if (!JudgeCasesUntilRejected(num_cases, judge_case, should_yield, next_case,
+                               &case_verdict))
+    return false;
+  *verdict = IsAccepted(case_verdict)
+                 ? ""
+                 : RenderRejectedCase(*next_case,
+                                      RenderCaseVerdict(case_verdict));
+  return true;
+}
+
+template <typename Inputs, typename Outputs, typename U, typename JudgeCaseF>
+string JudgeAllCases(const Inputs& input, const Outputs& correct_output,
+                     const vector<U>& attempt, JudgeCaseF JudgeCase) {
+  CheckNumberOfCases(attempt.size(), input.size());
+  if (Failed()) return "";
+  size_t next_case = 0;
+  string verdict;
+  JudgeCasesFrom(
+      input.size(),
+      [&](size_t i) { return JudgeCase(input[i], correct_output[i], attempt[i]); },
+      [] { return false; }, &next_case, &verdict);
+  return verdict;
+}
+
+template <typename T, typename U>
+string JudgeAllCases(const vector<T>& input, const vector<U>& correct_output,
+                     const vector<U>& attempt,
+                     string JudgeCase(const T&, const U&, const U&)) {
+  return JudgeAllCases<vector<T>, vector<U>, U,
+                       string (*)(const T&, const U&, const U&)>(
+      input, correct_output, attempt, JudgeCase);
+}
+
+// A problem type P bundles a problem's logic for the functions above:
+//   typedef ... Input;   // Parsed case input.
+//   typedef ... Output;  // Parsed case output.
+//   static Input ParseCaseInput(istream& in);
+//   static Output ParseCaseOutput(const vector<vector<string>>& lines);
+//   static Output ParseCaseOutput(const TokenCase& lines);  // Optional.
+//   static CaseVerdict JudgeCase(const Input& input,
+//                                const Output& correct_output,
+//                                const Output& attempt);  // Or a string.
+//   static uint64_t EstimateCaseCost(const Input& input);
+//   static CaseScore ScoreCase(const Input& input,
+//                              const Output& correct_output,
+//                              const Output& attempt);  // Optional.
+// Its functions are called through the callables below rather than function
+// pointers, so each problem gets its own instance of the pipeline, with its
+// per-case functions resolved, and inlinable, at compile time.
+template <typename P>
+struct ParseCaseInputOf {
+  typename P::Input operator()(istream& in) const {
+    return P::ParseCaseInput(in);
+  }
+};
+
+template <typename P>
+struct ParseCaseOutputOf {
+  // Lines are vector<vector<string>>, or a TokenCase if P takes them.
+  template <typename Lines>
+  auto operator()(const Lines& lines) const
+      -> decltype(P::ParseCaseOutput(lines)) {
+    return P::ParseCaseOutput(lines);
+  }
+};
+
+template <typename P>
+struct JudgeCaseOf {
+  auto operator()(const typename P::Input& input,
+                  const typename P::Output& correct_output,
+                  const typename P::Output& attempt) const {
+    return P::JudgeCase(input, correct_output, attempt);
+  }
+};
+
+template <typename P>
+vector<typename P::Input> ParseAllInput(const string& filename) {
+  ifstream in(filename);
+  return ParseAllInputFrom(in, ParseCaseInputOf<P>());
+}
+
+template <typename P>
+vector<typename P::Output> ParseAllOutput(const string& filename) {
+  return ParseAllOutput(filename, ParseCaseOutputOf<P>());
+}
+
+template <typename P>
+string JudgeAllCases(const vector<typename P::Input>& input,
+                     const vector<typename P::Output>& correct_output,
+                     const vector<typename P::Output>& attempt) {
+  return JudgeAllCases(input, correct_output, attempt, JudgeCaseOf<P>());
+}
+
+string JudgeCaseTest(const int& n, const int& m, const int& o) {
+  if (n != o) return Strint(o) + " not equal to input: " + Strint(n);
+  return "";
+};
+
+// Verdict of an attempt with typed case verdicts: accepted, or rejected on
+// case case_index.
+struct AttemptVerdict {
+  size_t case_index = 0;
+  CaseVerdict verdict;
+};
+
+// Like JudgeAllCases, for JudgeCase returning CaseVerdict.
+template <typename Inputs, typename Outputs, typename U, typename JudgeCaseF>
+AttemptVerdict JudgeAllCasesVerdict(const Inputs& input,
+                                    const Outputs& correct_output,
+                                    const vector<U>& attempt,
+                                    JudgeCaseF JudgeCase) {
+  AttemptVerdict r;
+  CheckNumberOfCases(attempt.size(), input.size());
+  if (Failed()) return r;
+  JudgeCasesUntilRejected(
+      input.size(),
+      [&](size_t i) { return JudgeCase(input[i], correct_output[i], attempt[i]); },
+      [] { return false; }, &r.case_index, &r.verdict);
+  return r;
+}
+
+// The message JudgeAllCases would return for v.
+string RenderAttemptVerdict(const AttemptVerdict& v) {
+  if (v.verdict.accepted()) return "";
+  return RenderRejectedCase(v.case_index, RenderCaseVerdict(v.verdict));
+}
+
+// Exact-match judging, for problems with a unique correct answer: every case
+// of the attempt must have the tokens of the correct output, ignoring
+// whitespace and the case of ASCII letters. Both files are compared in
+// place, case by case, without tokenizing them.
+
+// Whether a[0, a_n) and b[0, b_n) have the same tokens up to ASCII case. Runs
+// of equal bytes are skipped with simd->common_folded_prefix, so files
+// formatted alike are compared in bulk, and only differences in whitespace
+// are looked at byte by byte.
+bool SameTokens(const char* a, size_t a_n, const char* b, size_t b_n) {
+  size_t i = 0, j = 0;
+  // Whether a[i - 1] and b[j - 1] end equal prefixes of a token.
+  bool in_token = false;
+  for (;;) {
+    const size_t n = simd->common_folded_prefix(a + i, b + j,
+                                                min(a_n - i, b_n - j));
+    if (n > 0) {
+      in_token = !IsTokenSpace(a[i + n - 1]);
+      i += n;
+      j += n;
+    }
+    const bool a_space = i == a_n || IsTokenSpace(a[i]);
+    const bool b_space = j == b_n || IsTokenSpace(b[j]);
+    if (!a_space && !b_space) return false;
+    if (in_token && a_space != b_space) return false;
+    while (i < a_n && IsTokenSpace(a[i])) ++i;
+    while (j < b_n && IsTokenSpace(b[j])) ++j;
+    in_token = false;
+    if (i == a_n || j == b_n) return i == a_n && j == b_n;
+  }
+}
+
+// Message of the first difference between the tokens of correct[c, c_end)
+// and attempt[a, a_end), which SameTokens found to differ. Tokens are
+// numbered within their line of the attempt's case, as ParseCaseOutput sees
+// it: line 1 is the rest of the case header line, and the other lines count
+// only if they have tokens. A missing token is numbered as if it followed the
+// attempt's last one.
+string DescribeTokenMismatch(string_view correct, size_t c, size_t c_end,
+                             string_view attempt, size_t a, size_t a_end) {
+  // Position of the last token read from the attempt.
+  size_t line = 1, index = 0;
+  for (;;) {
+    const string_view expected = NextToken(correct, &c, c_end);
+    bool new_line = false;
+    while (a < a_end && IsTokenSpace(attempt[a]))
+      if (attempt[a++] == '\n') new_line = true;
+    const string_view found = NextToken(attempt, &a, a_end);
+    if (!found.empty()) {
+      index = new_line ? 1 : index + 1;
+      if (new_line) ++line;
+    }
+    if (expected.size() == found.size() &&
+        simd->common_folded_prefix(expected.data(), found.data(),
+                                   found.size()) == found.size()) {
+      if (found.empty()) return "";
+      continue;
+    }
+    const string e = Truncate(Lowercase(string(expected)));
+    const string f = Truncate(Lowercase(string(found)));
+    if (found.empty()) {
+      return "Missing token " + Strint(index + 1) + " of line " +
+             Strint(line) + ", expected: " + e;
+    }
+    const string position = Strint(index) + " of line " + Strint(line);
+    if (expected.empty()) return "Extra token " + position + ": " + f;
+    return "Token " + position + " is " + f + ", expected: " + e;
+  }
+}
+
+// Like JudgeAllCases for a problem whose JudgeCase compares the tokens of the
+// attempt with those of the correct output. The attempt raises the same
+// errors as with ParseAllOutput, and the first differing case is reported in
+// the same "Case #k: " format.
+string JudgeExactMatch(const string& correct_output_file,
+                       const string& attempt_file) {
+  const FileContents attempt_contents(attempt_file);
+  const string_view attempt = attempt_contents.view();
+  CheckOutputText(attempt);
+  if (Failed()) return "";
+  const vector<size_t> attempt_headers = FindCaseHeaders(attempt);
+  const vector<size_t> attempt_bodies =
+      CheckCaseHeaders(attempt, attempt_headers, 1);
+  if (Failed()) return "";
+  const FileContents correct_contents(correct_output_file);
+  const string_view correct = correct_contents.view();
+  CheckOutputText(correct);
+  if (Failed()) return "";
+  const vector<size_t> correct_headers = FindCaseHeaders(correct);
+  const vector<size_t> correct_bodies =
+      CheckCaseHeaders(correct, correct_headers, 1);
+  if (Failed()) return "";
+  CheckNumberOfCases(attempt_headers.size(), correct_headers.size());
+  if (Failed()) return "";
+  const size_t num_cases = correct_headers.size();
+  for (size_t k = 0; k < num_cases; ++k) {
+    ScopedDeadline case_deadline(case_cpu_budget_ns);
+    CheckDeadline();
+    if (Failed()) return "";
+    const size_t c = correct_bodies[k], a = attempt_bodies[k];
+    const size_t c_end =
+        k + 1 < num_cases ? correct_headers[k + 1] : correct.size();
+    const size_t a_end =
+        k + 1 < num_cases ? attempt_headers[k + 1] : attempt.size();
+    if (!SameTokens(correct.data() + c, c_end - c, attempt.data() + a,
+                    a_end - a))
+      return RenderRejectedCase(
+          k, DescribeTokenMismatch(correct, c, c_end, attempt, a, a_end));
+  }
+  return "";
+}
+
+void TestJudgeExactMatch() {
+  // SameTokens agrees with comparing lowercased token lists.
+  mt19937 rng(5);
+  const string alphabet = "aAbB1 \t\n";
+  for (int t = 0; t < 3000; ++t) {
+    string a(rng() % 70, ' ');
+    for (char& c : a) c = alphabet[rng() % alphabet.size()];
+    string b = a;
+    for (char& c : b) {
+      if (rng() % 20 == 0) c = alphabet[rng() % alphabet.size()];
+    }
+    if (rng() % 3 == 0) b += alphabet[rng() % alphabet.size()];
+    const bool expected = Tokenize(a) == Tokenize(b);
+    assert(SameTokens(a.data(), a.size(), b.data(), b.size()) == expected);
+    assert(SameTokens(b.data(), b.size(), a.data(), a.size()) == expected);
+  }
+  const string prefix = "/tmp/judge_exact_match_test_" + Strint(getpid());
+  ofstream(prefix + "_out") << "Case #1: Hello World\nCase #2: 1 2\n3\n"
+                               "Case #3:\n";
+  auto judge = [&](const string& attempt) {
+    ofstream(prefix + "_attempt") << attempt;
+    return JudgeExactMatch(prefix + "_out", prefix + "_attempt");
+  };
+  assert(judge("Case #1: Hello World\nCase #2: 1 2\n3\nCase #3:\n") == "");
+  assert(judge("case #1:   hELLO\r\n\tworld\nCASE #2: 1\n2 3 Case\nCase #3:") ==
+         "Case #2: Extra token 3 of line 2: case");
+  assert(judge("Case #1: hello world\nCase #2: 1 2 3\ncase #3:") == "");
+  assert(judge("Case #1: hello worlds\nCase #2: 1 2 3\nCase #3:") ==
+         "Case #1: Token 2 of line 1 is worlds, expected: world");
+  assert(judge("Case #1: hello world\nCase #2: 1 2\nCase #3: 3\n") ==
+         "Case #2: Missing token 3 of line 1, expected: 3");
+  assert(judge("Case #1: hello world\nCase #2: 12 3\nCase #3:\n") ==
+         "Case #2: Token 1 of line 1 is 12, expected: 1");
+  assert(judge("Case #1: hello world\nCase #2: 1\n\n 2 4\nCase #3:\n") ==
+         "Case #2: Token 2 of line 2 is 4, expected: 3");
+  assert(judge("Case #1:\nhello\nCase #2: 1 2 3\nCase #3:\n") ==
+         "Case #1: Missing token 2 of line 2, expected: world");
+  assert(judge("Case #1:\n\n\nhello\n\nWorld!\nCase #2: 1 2 3\nCase #3:\n") ==
+         "Case #1: Token 1 of line 3 is world!, expected: world");
+  AssertError(judge("Case #1: hello world\nCase #2: 1 2 3\n"),
+              "Wrong number of cases in attempt: 2, expected: 3");
+  AssertError(judge("Case #1: hello world\nCase #3: 1 2 3\n"),
+              "Found case: 3, expected: 2");
+  AssertError(judge(string("Case #1: hello\0world\n", 21)),
+              "Invalid byte 0x00 in output on line 1");
+  remove((prefix + "_out").c_str());
+  remove((prefix + "_attempt").c_str());
+}
+
+// Scoring, for optimization problems: each case of an attempt gets a score as
+// well as a verdict, and the attempt gets the total of its cases' scores.
+
+// Verdict and score of one case. Rejected cases score 0.
+struct CaseScore {
+  CaseVerdict verdict;
+  double score = 0;
+};
+
+// Verdict of an attempt, as JudgeAllCasesVerdict would give it, with the score
+// of each case and their total.
+struct AttemptScore {
+  AttemptVerdict verdict;
+  vector<double> case_scores;
+  double total = 0;
+};
+
+// Scores are summed in groups of this many, whatever the number of threads.
+const size_t kScoreSumGroup = 256;
+
+// Sum of v, the same to the bit for any num_threads: each group of
+// kScoreSumGroup values is summed in order, the groups split between the
+// threads, and the group sums are then added pairwise.
+double DeterministicSum(const vector<double>& v, int num_threads = 1) {
+  vector<double> sums((v.size() + kScoreSumGroup - 1) / kScoreSumGroup);
+  if (sums.empty()) return 0;
+  num_threads = (int)min<size_t>(max(num_threads, 1), sums.size());
+  auto sum_groups = [&](size_t first, size_t last) {
+    for (size_t g = first; g < last; ++g) {
+      double sum = 0;
+      const size_t end = min(v.size(), (g + 1) * kScoreSumGroup);
+      for (size_t i = g * kScoreSumGroup; i < end; ++i) sum += v[i];
+      sums[g] = sum;
+    }
+  };
+  vector<thread> threads;
+  for (int i = 1; i < num_threads; ++i)
+    threads.emplace_back(sum_groups, sums.size() * i / num_threads,
+                         sums.size() * (i + 1) / num_threads);
+  sum_groups(0, sums.size() / num_threads);
+  for (thread& t : threads) t.join();
+  for (size_t width = 1; width < sums.size(); width *= 2)
+    for (size_t i = 0; i + width < sums.size(); i += 2 * width)
+      sums[i] += sums[i + width];
+  return sums[0];
+}
+
+void TestDeterministicSum() {
+  assert(DeterministicSum({}) == 0);
+  assert(DeterministicSum({1.5}, 4) == 1.5);
+  mt19937 rng(7);
+  vector<double> v(3000);
+  for (double& x : v) x = ldexp((double)rng(), (int)(rng() % 80) - 60);
+  const double sum = DeterministicSum(v);
+  for (int threads = 2; threads <= 5; ++threads)
+    assert(DeterministicSum(v, threads) == sum);
+  assert(fabs(sum - accumulate(v.begin(), v.end(), 0.0)) <= 1e-9 * sum);
+}
+
+// Cases ScoreAttempt reads from the attempt before scoring them together.
+const size_t kScoreBlockCases = 4096;
+
+// Scores the attempt in attempt_file against input and correct_output with
+// ScoreCase(input, correct_output, attempt), which returns a CaseScore. The
+// file is streamed through a CaseReader, kScoreBlockCases cases at a time, and
+// the cases of each block are tokenized, parsed and scored on num_threads
+// threads that share the caller's deadline, each case under
+// case_cpu_budget_ns. Raises the errors ParseAllOutput
+// and JudgeAllCasesVerdict would, in the same order: errors scoring a case
+// are held until the whole attempt is parsed and its number of cases checked.
+// An invalid byte is only found if the case headers before it are valid.
+template <typename Inputs, typename Outputs, typename ParseCaseOutputF,
+          typename ScoreCaseF>
+AttemptScore ScoreAttempt(const Inputs& input, const Outputs& correct_output,
+                          const string& attempt_file,
+                          ParseCaseOutputF ParseCaseOutput,
+                          ScoreCaseF ScoreCase, int num_threads = 1) {
+  vector<CaseScore> scores(input.size());
+  CaseReader reader(attempt_file);
+  string block;
+  vector<size_t> case_begin, bodies;
+  // The first error parsing a case. Once there is one, the rest of the
+  // attempt is only read, for the errors of the reader that come first.
+  string error;
+  // The first error scoring a case. Once there is one, the rest of the
+  // attempt is only parsed.
+  string score_error;
+  for (bool more = true; more;) {
+    block.clear();
+    case_begin.assign(1, 0);
+    bodies.clear();
+    const size_t first = reader.num_cases();
+    string_view text;
+    size_t body;
+    while (bodies.size() < kScoreBlockCases &&
+           (more = reader.Next(&text, &body))) {
+      bodies.push_back(block.size() + body);
+      block += text;
+      case_begin.push_back(block.size());
+    }
+    if (Failed()) return AttemptScore();
+    if (!error.empty()) continue;
+    // Slice i is cases [n * i / threads, n * (i + 1) / threads) of the block.
+    const size_t n = bodies.size();
+    const int threads = (int)max<size_t>(1, min<size_t>(num_threads, n));
+    vector<string> errors(threads), score_errors(threads);
+    auto score_slice = [&](int i) {
+      TokenTable table;
+      for (size_t k = n * i / threads; k < n * (i + 1) / threads; ++k) {
+        CheckDeadline();
+        table.clear();
+        AppendCaseTokens(block, bodies[k], case_begin[k + 1], &table);
+        if (Failed()) return;
+        const auto attempt =
+            ParseTokenCase(ParseCaseOutput, TokenCase(table, 0));
+        if (Failed()) return;
+        const size_t c = first + k;
+        if (c >= input.size() || !score_error.empty() ||
+            !score_errors[i].empty())
+          continue;
+        CatchError(
+            [&] {
+              ScopedDeadline case_deadline(case_cpu_budget_ns);
+              CheckDeadline();
+              if (!Failed())
+                scores[c] = ScoreCase(input[c], correct_output[c], attempt);
+              CheckDeadline();
+            },
+            &score_errors[i]);
+      }
+    };
+    CpuPool pool;
+    vector<thread> workers;
+    for (int i = 1; i < threads; ++i) {
+      workers.emplace_back([&, i] {
+        CpuPool::Helper helper(pool);
+        CatchError([&] { score_slice(i); }, &errors[i]);
+      });
+    }
+    CatchError([&] { score_slice(0); }, &errors[0]);
+    for (thread& t : workers) t.join();
+    for (const string& e : errors) {
+      if (!e.empty()) {
+        error = e;
+        break;
+      }
+    }
+    // The threads may have used up the deadline together after each one's
+    // last check.
+    if (error.empty()) CatchError([] { CheckDeadline(); }, &error);
+    for (const string& e : score_errors) {
+      if (score_error.empty()) score_error = e;
+    }
+  }
+  auto raise = [](const string& e) {
+    if (e == kJudgeTimeLimitError) JudgeTimeLimitExceeded();
+    Error(e);
+  };
+  if (!error.empty()) {
+    raise(error);
+    return AttemptScore();
+  }
+  CheckNumberOfCases(reader.num_cases(), input.size());
+  if (Failed()) return AttemptScore();
+  if (!score_error.empty()) {
+    raise(score_error);
+    return AttemptScore();
+  }
+  AttemptScore r;
+  r.case_scores.resize(scores.size());
+  for (size_t c = 0; c < scores.size(); ++c) {
+    if (scores[c].verdict.accepted()) {
+      r.case_scores[c] = scores[c].score;
+    } else if (r.verdict.verdict.accepted()) {
+      r.verdict.case_index = c;
+      r.verdict.verdict = scores[c].verdict;
+    }
+  }
+  r.total = DeterministicSum(r.case_scores, num_threads);
+  return r;
+}
+
+template <typename P>
+struct ScoreCaseOf {
+  CaseScore operator()(const typename P::Input& input,
+                       const typename P::Output& correct_output,
+                       const typename P::Output& attempt) const {
+    return P::ScoreCase(input, correct_output, attempt);
+  }
+};
+
+template <typename P>
+AttemptScore ScoreAttempt(const vector<typename P::Input>& input,
+                          const vector<typename P::Output>& correct_output,
+                          const string& attempt_file, int num_threads = 1) {
+  return ScoreAttempt(input, correct_output, attempt_file,
+                      ParseCaseOutputOf<P>(), ScoreCaseOf<P>(), num_threads);
+}
+
+// Online judging: the attempt is judged while the contestant is still writing
+// it, through a pipe or a file that grows, so that judging overlaps with the
+// contestant's run.
+
+// Whether the process pid is still running. A zombie, which exited but was not
+// waited for yet, is not: its state in /proc/PID/stat, the field after the
+// parenthesized command name, is 'Z'.
+bool ProcessRunning(pid_t pid) {
+  if (kill(pid, 0) != 0 && errno != EPERM) return false;
+  ifstream in("/proc/" + Strint(pid) + "/stat");
+  string stat;
+  if (!getline(in, stat)) return true;
+  const size_t name_end = stat.rfind(')');
+  if (name_end == string::npos || name_end + 2 >= stat.size()) return true;
+  const char state = stat[name_end + 2];
+  return state != 'Z' && state != 'X';
+}
+
+// Judges the attempt read by reader as it is written: each case is parsed and
+// judged as soon as the next case header or the end of the attempt shows that
+// it is complete, and judging stops at the first rejected case without
+// waiting for the rest. Raises the errors of ParseAllOutput and JudgeAllCases,
+// but in the order of the cases: a rejected case is reported even if a later
+// case is malformed or missing.
+template <typename Inputs, typename Outputs, typename ParseCaseOutputF,
+          typename JudgeCaseF>
+string JudgeAllCasesOnline(const Inputs& input, const Outputs& correct_output,
+                           CaseReader* reader,
+                           ParseCaseOutputF ParseCaseOutput,
+                           JudgeCaseF JudgeCase) {
+  TokenTable table;
+  string_view text;
+  size_t body;
+  while (reader->Next(&text, &body)) {
+    table.clear();
+    AppendCaseTokens(text, body, text.size(), &table);
+    if (Failed()) return "";
+    const auto attempt = ParseTokenCase(ParseCaseOutput, TokenCase(table, 0));
+    if (Failed()) return "";
+    // Cases past the input are only counted.
+    const size_t i = reader->num_cases() - 1;
+    if (i >= input.size()) continue;
+    typename decay<decltype(JudgeCase(input[i], correct_output[i],
+                                      attempt))>::type verdict;
+    {
+      ScopedDeadline case_deadline(case_cpu_budget_ns);
+      CheckDeadline();
+      if (!Failed()) verdict = JudgeCase(input[i], correct_output[i], attempt);
+      CheckDeadline();
+    }
+    if (Failed()) return "";
+    if (!IsAccepted(verdict))
+      return RenderRejectedCase(i, RenderCaseVerdict(verdict));
+  }
+  if (Failed()) return "";
+  CheckNumberOfCases(reader->num_cases(), input.size());
+  return "";
+}
+
+string JsonQuote(const string& s) {
+  string r = "\"";
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      r += '\\';
+      r += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      r += escaped;
+    } else {
+      r += c;
+    }
+  }
+  return r + "\"";
+}
+
+// Machine-readable verdicts, one JSON object per line: "verdict" is ACCEPTED,
+// REJECTED or JUDGE_TIME_LIMIT, and "message" what the judge prints. Typed
+// rejections also have the 1-based "case", the kind's "code", and "expected"
+// and "got" if they have details.
+string FormatVerdictJson(const string& error) {
+  if (error.empty()) return "{\"verdict\":\"ACCEPTED\"}";
+  return string("{\"verdict\":\"") +
+         (error == kJudgeTimeLimitError ? "JUDGE_TIME_LIMIT" : "REJECTED") +
+         "\",\"message\":" + JsonQuote(error) + "}";
+}
+
+string FormatVerdictJson(const AttemptVerdict& v) {
+  if (v.verdict.accepted()) return FormatVerdictJson("");
+  string r = "{\"verdict\":\"REJECTED\",\"case\":" + Strint(v.case_index + 1) +
+             ",\"code\":" + JsonQuote(v.verdict.kind->name);
+  if (v.verdict.has_details)
+    r += ",\"expected\":" + Strint(v.verdict.expected) +
+         ",\"got\":" + Strint(v.verdict.got);
+  return r + ",\"message\":" + JsonQuote(RenderAttemptVerdict(v)) + "}";
+}
+
+const VerdictKind kTooLargeTest = {"TOO_LARGE", "too large"};
+
+CaseVerdict JudgeCaseVerdictTest(const int& n, const int& m, const int& o) {
+  if (o > n) return Reject(kTooLargeTest, n, o);
+  return CaseVerdict();
+}
+
+void TestCaseVerdicts() {
+  const vector<int> input = {1, 2, 3};
+  AttemptVerdict v =
+      JudgeAllCasesVerdict(input, input, input, JudgeCaseVerdictTest);
+  assert(v.verdict.accepted() && RenderAttemptVerdict(v) == "");
+  assert(FormatVerdictJson(v) == "{\"verdict\":\"ACCEPTED\"}");
+  v = JudgeAllCasesVerdict(input, input, vector<int>({1, 3, 4}),
+                           JudgeCaseVerdictTest);
+  assert(v.case_index == 1 && v.verdict.kind == &kTooLargeTest);
+  assert(v.verdict.expected == 2 && v.verdict.got == 3);
+  assert(RenderAttemptVerdict(v) == "Case #2: too large");
+  assert(FormatVerdictJson(v) ==
+         "{\"verdict\":\"REJECTED\",\"case\":2,\"code\":\"TOO_LARGE\","
+         "\"expected\":2,\"got\":3,\"message\":\"Case #2: too large\"}");
+  assert(JudgeAllCases(input, input, vector<int>({1, 3, 4}),
+                       JudgeCaseVerdictTest) == "Case #2: too large");
+  AssertError(JudgeAllCasesVerdict(input, input, vector<int>({1}),
+                                   JudgeCaseVerdictTest),
+              "Wrong number of cases in attempt: 1, expected: 3");
+  assert(FormatVerdictJson("Found \"x\"\n") ==
+         "{\"verdict\":\"REJECTED\",\"message\":\"Found \\\"x\\\"\\u000a\"}");
+  assert(FormatVerdictJson(kJudgeTimeLimitError) ==
+         "{\"verdict\":\"JUDGE_TIME_LIMIT\",\"message\":"
+         "\"Judge time limit exceeded\"}");
+}
+
+string SlowJudgeCaseTest(const int& n, const int& m, const int& o) {
+  SpinCpu(2000000);
+  return JudgeCaseTest(n, m, o);
+}
+
+void TestJudgeAllCases() {
+  case_cpu_budget_ns = 1000000;
+  AssertError(JudgeAllCases({1}, {1}, {1}, SlowJudgeCaseTest), kJudgeTimeLimitError);
+  assert(JudgeAllCases({1}, {1}, {1}, JudgeCaseTest) == "");
+  case_cpu_budget_ns = 0;
+  assert(JudgeAllCases({1}, {1}, {1}, SlowJudgeCaseTest) == "");
+  {
+    ScopedDeadline deadline(3000000);
+    AssertError(JudgeAllCases({1, 2}, {1, 2}, {1, 2}, SlowJudgeCaseTest),
+                kJudgeTimeLimitError);
+  }
+
+  AssertError(JudgeAllCases({1}, {1}, {1, 2}, JudgeCaseTest),
+              "Wrong number of cases in attempt: 2, expected: 1");
+  AssertError(JudgeAllCases({1, 2}, {1, 2}, {1}, JudgeCaseTest),
+              "Wrong number of cases in attempt: 1, expected: 2");
+  AssertError(JudgeAllCases({1, 2}, {1, 2}, {}, JudgeCaseTest),
+              "Wrong number of cases in attempt: 0, expected: 2");
+  assert(JudgeAllCases({1}, {1}, {1}, JudgeCaseTest) == "");
+  assert(JudgeAllCases({1}, {1}, {2}, JudgeCaseTest) ==
+         "Case #1: 2 not equal to input: 1");
+  assert(JudgeAllCases({1, 1}, {1, 1}, {2, 2}, JudgeCaseTest) ==
+         "Case #1: 2 not equal to input: 1");
+  assert(JudgeAllCases({1, 2}, {1, 2}, {1, 2}, JudgeCaseTest) == "");
+  assert(JudgeAllCases({1, 2}, {1, 2}, {1, 1}, JudgeCaseTest) ==
+         "Case #2: 1 not equal to input: 2");
+}
+
+uint64_t Mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Fast non-cryptographic 64-bit hash used to key caches by content. Four
+// independent lanes keep the multiplier pipelined on long inputs.
+uint64_t HashBytes(const char* data, size_t size, uint64_t seed = 0) {
+  const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+  uint64_t lane[4] = {seed ^ kMul, seed + size, ~seed, seed * kMul + 1};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int k = 0; k < 4; ++k) {
+      uint64_t w;
+      memcpy(&w, data + i + 8 * k, 8);
+      lane[k] = (lane[k] ^ w) * kMul;
+      lane[k] = (lane[k] << 31) | (lane[k] >> 33);
+    }
+  }
+  for (int k = 0; i < size; i += 8, ++k) {
+    uint64_t w = 0;
+    memcpy(&w, data + i, min<size_t>(8, size - i));
+    lane[k] = ((lane[k] ^ w) * kMul) + 1;
+  }
+  uint64_t h = Mix64(size ^ seed);
+  for (int k = 0; k < 4; ++k) h = Mix64(h ^ lane[k]) * kMul;
+  return Mix64(h);
+}
+
+uint64_t HashBytes(string_view s, uint64_t seed = 0) {
+  return HashBytes(s.data(), s.size(), seed);
+}
+
+// Hashes the contents of a file, returning false if it cannot be read.
+bool HashFile(const string& filename, uint64_t* hash) {
+  MappedFile file(filename);
+  if (!file.ok()) return false;
+  *hash = HashBytes(file.view());
+  return true;
+}
+
+void TestHashBytes() {
+  assert(HashBytes("") == HashBytes(""));
+  assert(HashBytes("") != HashBytes(string(1, '\0')));
+  assert(HashBytes("abc") != HashBytes("abd"));
+  assert(HashBytes("abc") != HashBytes("abc", 1));
+  const string s(1000, 'x');
+  set<uint64_t> prefixes;
+  for (size_t i = 0; i <= s.size(); ++i)
+    prefixes.insert(HashBytes(s.data(), i));
+  assert(prefixes.size() == s.size() + 1);
+  string t = s;
+  t[997] = 'y';
+  assert(HashBytes(s) != HashBytes(t));
+}
+
+// Appends fixed-size values to a byte buffer.
+class BinaryWriter {
+ public:
+  template <typename V>
+  void Write(const V& v) {
+    static_assert(is_trivially_copyable<V>::value, "");
+    buffer_.append(reinterpret_cast<const char*>(&v), sizeof(V));
+  }
+  template <typename V>
+  void WriteArray(const vector<V>& v) {
+    static_assert(is_trivially_copyable<V>::value, "");
+    buffer_.append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(V));
+  }
+  const string& buffer() const { return buffer_; }
+
+ private:
+  string buffer_;
+};
+
+// Read-only array of values of V in place in a byte range, such as a mapped
+// file, that need not be aligned for V. Elements are copied out when read.
+template <typename V>
+class UnalignedArray {
+ public:
+  static_assert(is_trivially_copyable<V>::value, "");
+  UnalignedArray() = default;
+  UnalignedArray(const char* data, size_t size) : data_(data), size_(size) {}
+  size_t size() const { return size_; }
+  V operator[](size_t i) const {
+    V v;
+    memcpy(&v, data_ + i * sizeof(V), sizeof(V));
+    return v;
+  }
+  // Copies elements [begin, begin + n) to out.
+  void CopyTo(size_t begin, size_t n, V* out) const {
+    if (n > 0) memcpy(out, data_ + begin * sizeof(V), n * sizeof(V));
+  }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Bounds-checked reader over a byte range written by BinaryWriter. Reads past
+// the end return false and leave the output untouched.
+class BinaryReader {
+ public:
+  explicit BinaryReader(string_view data) : data_(data) {}
+  template <typename V>
+  bool Read(V* v) {
+    if (data_.size() - pos_ < sizeof(V)) return false;
+    memcpy(v, data_.data() + pos_, sizeof(V));
+    pos_ += sizeof(V);
+    return true;
+  }
+  template <typename V>
+  bool ReadArray(size_t n, vector<V>* v) {
+    if ((data_.size() - pos_) / sizeof(V) < n) return false;
+    v->resize(n);
+    if (n > 0) memcpy(v->data(), data_.data() + pos_, n * sizeof(V));
+    pos_ += n * sizeof(V);
+    return true;
+  }
+  // Like ReadArray, pointing v at the array in place instead of copying it.
+  template <typename V>
+  bool ViewArray(size_t n, UnalignedArray<V>* v) {
+    if ((data_.size() - pos_) / sizeof(V) < n) return false;
+    *v = UnalignedArray<V>(data_.data() + pos_, n);
+    pos_ += n * sizeof(V);
+    return true;
+  }
+  bool AtEnd() const { return pos_ == data_.size(); }
+
+ private:
+  string_view data_;
+  size_t pos_ = 0;
+};
+
+void TestBinaryReaderWriter() {
+  BinaryWriter out;
+  out.Write<int32_t>(-7);
+  out.WriteArray(vector<uint8_t>({1, 2, 3}));
+  out.Write<uint64_t>(1ULL << 40);
+  BinaryReader in(out.buffer());
+  int32_t a;
+  vector<uint8_t> b;
+  uint64_t c;
+  assert(in.Read(&a) && a == -7);
+  assert(in.ReadArray(3, &b) && b == vector<uint8_t>({1, 2, 3}));
+  assert(!in.AtEnd());
+  assert(in.Read(&c) && c == (1ULL << 40));
+  assert(in.AtEnd());
+  assert(!in.Read(&a));
+  assert(!in.ReadArray(1, &b));
+  BinaryReader short_in(string_view(out.buffer()).substr(0, 6));
+  assert(short_in.Read(&a));
+  assert(!short_in.ReadArray(3, &b));
+  assert(!short_in.Read(&c));
+  // The uint64_t is at offset 7, unaligned, and read in place.
+  BinaryReader view_in(out.buffer());
+  UnalignedArray<uint8_t> bytes;
+  UnalignedArray<uint64_t> words;
+  assert(view_in.Read(&a) && view_in.ViewArray(3, &bytes));
+  assert(bytes.size() == 3 && bytes[0] == 1 && bytes[2] == 3);
+  assert(!view_in.ViewArray(2, &words));
+  assert(view_in.ViewArray(1, &words) && words[0] == (1ULL << 40));
+  assert(view_in.AtEnd());
+  uint8_t copied[2];
+  bytes.CopyTo(1, 2, copied);
+  assert(copied[0] == 2 && copied[1] == 3);
+}
+
+// Precompiled test sets: the parsed input and correct output of a test set,
+// encoded by the problem into a payload and wrapped in a header that records
+// the format version, a content hash of the source text files and a checksum
+// of the payload. A judge maps the image instead of parsing text, and falls
+// back to text when the image is missing, corrupt or built from other sources.
+const char kTestSetMagic[8] = {'C', 'J', 'T', 'E', 'S', 'T', 'S', 'T'};
+const uint32_t kTestSetFormatVersion = 2;
+
+struct TestSetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t source_hash;
+  uint64_t payload_size;
+  uint64_t payload_checksum;
+};
+
+uint64_t TestSetSourceHash(uint64_t input_hash, uint64_t output_hash) {
+  return Mix64(input_hash ^ Mix64(output_hash + 0x9e3779b97f4a7c15ULL));
+}
+
+string BuildTestSetImage(uint64_t source_hash, const string& payload) {
+  TestSetHeader header;
+  memcpy(header.magic, kTestSetMagic, sizeof(kTestSetMagic));
+  header.version = kTestSetFormatVersion;
+  header.reserved = 0;
+  header.source_hash = source_hash;
+  header.payload_size = payload.size();
+  header.payload_checksum = HashBytes(payload);
+  BinaryWriter out;
+  out.Write(header);
+  return out.buffer() + payload;
+}
+
+// Validates an image against the expected source hash and, on success,
+// points payload at the encoded test set inside it.
+bool OpenTestSetImage(string_view image, uint64_t source_hash,
+                      string_view* payload) {
+  BinaryReader in(image);
+  TestSetHeader header;
+  if (!in.Read(&header)) return false;
+  if (memcmp(header.magic, kTestSetMagic, sizeof(kTestSetMagic)) != 0 ||
+      header.version != kTestSetFormatVersion ||
+      header.source_hash != source_hash ||
+      header.payload_size != image.size() - sizeof(header))
+    return false;
+  string_view p = image.substr(sizeof(header));
+  if (HashBytes(p) != header.payload_checksum) return false;
+  *payload = p;
+  return true;
+}
+
+void TestTestSetImage() {
+  const string payload = "payload bytes";
+  const string image = BuildTestSetImage(42, payload);
+  string_view p;
+  assert(OpenTestSetImage(image, 42, &p) && p == payload);
+  assert(!OpenTestSetImage(image, 43, &p));
+  assert(!OpenTestSetImage(image.substr(0, image.size() - 1), 42, &p));
+  assert(!OpenTestSetImage(image.substr(0, 10), 42, &p));
+  assert(!OpenTestSetImage("", 42, &p));
+  string corrupt = image;
+  corrupt.back() ^= 1;
+  assert(!OpenTestSetImage(corrupt, 42, &p));
+  string old_version = image;
+  old_version[8] = 0;
+  assert(!OpenTestSetImage(old_version, 42, &p));
+  assert(OpenTestSetImage(BuildTestSetImage(7, ""), 7, &p) && p.empty());
+}
+
+// Content hash of the source files of a test set, or false if either cannot
+// be read.
+bool HashTestSetSources(const string& input_file, const string& output_file,
+                        uint64_t* source_hash) {
+  uint64_t input_hash, output_hash;
+  if (!HashFile(input_file, &input_hash) || !HashFile(output_file, &output_hash))
+    return false;
+  *source_hash = TestSetSourceHash(input_hash, output_hash);
+  return true;
+}
+
+// Parses the input and correct output text files into a test set image.
+template <typename T, typename U>
+string CompileTestSetImage(const string& input_file, const string& output_file,
+                           uint64_t source_hash, T ParseCaseInputF(istream&),
+                           U ParseCaseOutputF(const vector<vector<string>>&),
+                           void EncodeF(const vector<T>&, const vector<U>&,
+                                        BinaryWriter&)) {
+  const vector<T> input = ParseAllInput(input_file, ParseCaseInputF);
+  const vector<U> output = ParseAllOutput(output_file, ParseCaseOutputF);
+  BinaryWriter payload;
+  EncodeF(input, output, payload);
+  return BuildTestSetImage(source_hash, payload.buffer());
+}
+
+// The cases of a test set: held in a vector, or decoded one at a time from a
+// test set image that stays mapped for as long as they are in use, so that a
+// judge keeps no copy of its own of a precompiled or shared test set. Reads
+// return copies. The judging functions take it wherever they take the inputs
+// or correct outputs of a test set.
+template <typename V>
+class TestSetCases {
+ public:
+  TestSetCases() = default;
+  TestSetCases(vector<V> cases) : owned_(move(cases)), size_(owned_.size()) {}
+  // Cases decode(0), ..., decode(size - 1).
+  TestSetCases(size_t size, function<V(size_t)> decode)
+      : decode_(move(decode)), size_(size) {}
+
+  size_t size() const { return size_; }
+  V operator[](size_t i) const { return decode_ ? decode_(i) : owned_[i]; }
+
+  // Keeps mapping, which holds the image the cases are decoded from, alive
+  // for as long as the cases are.
+  void Keep(shared_ptr<const void> mapping) { mapping_ = move(mapping); }
+
+ private:
+  vector<V> owned_;
+  function<V(size_t)> decode_;
+  shared_ptr<const void> mapping_;
+  size_t size_ = 0;
+};
+
+// Serves a test set in place from image, which mapping keeps mapped: ViewF
+// checks the payload and points input and output at the cases in it. Returns
+// false, leaving the outputs untouched, if the image is corrupt or was built
+// from other sources.
+template <typename T, typename U>
+bool ViewTestSetImage(string_view image, uint64_t source_hash,
+                      shared_ptr<const void> mapping,
+                      bool ViewF(BinaryReader&, TestSetCases<T>*,
+                                 TestSetCases<U>*),
+                      TestSetCases<T>* input, TestSetCases<U>* output) {
+  string_view payload;
+  if (!OpenTestSetImage(image, source_hash, &payload)) return false;
+  BinaryReader in(payload);
+  TestSetCases<T> viewed_input;
+  TestSetCases<U> viewed_output;
+  if (!ViewF(in, &viewed_input, &viewed_output) || !in.AtEnd()) return false;
+  viewed_input.Keep(mapping);
+  viewed_output.Keep(move(mapping));
+  *input = move(viewed_input);
+  *output = move(viewed_output);
+  return true;
+}
+
+// Writes the test set image for the given sources to cache_file. The file is
+// written under a temporary name and renamed, so concurrent judges never
+// observe a partial image.
+template <typename T, typename U>
+bool CompileTestSet(const string& input_file, const string& output_file,
+                    const string& cache_file, T ParseCaseInputF(istream&),
+                    U ParseCaseOutputF(const vector<vector<string>>&),
+                    void EncodeF(const vector<T>&, const vector<U>&,
+                                 BinaryWriter&)) {
+  uint64_t source_hash;
+  if (!HashTestSetSources(input_file, output_file, &source_hash)) return false;
+  const string image =
+      CompileTestSetImage(input_file, output_file, source_hash, ParseCaseInputF,
+                          ParseCaseOutputF, EncodeF);
+  const string tmp_file = cache_file + ".tmp" + Strint(getpid());
+  {
+    ofstream out(tmp_file, ios::binary);
+    out.write(image.data(), image.size());
+    if (!out.good()) return false;
+  }
+  return rename(tmp_file.c_str(), cache_file.c_str()) == 0;
+}
+
+// Serves a test set compiled by CompileTestSet in place from the mapped
+// cache_file. Returns false, leaving the outputs untouched, if the cache is
+// missing, corrupt, or stale with respect to the current contents of the
+// source files.
+template <typename T, typename U>
+bool LoadTestSet(const string& input_file, const string& output_file,
+                 const string& cache_file,
+                 bool ViewF(BinaryReader&, TestSetCases<T>*, TestSetCases<U>*),
+                 TestSetCases<T>* input, TestSetCases<U>* output) {
+  const auto image = make_shared<const MappedFile>(cache_file);
+  uint64_t source_hash;
+  return image->ok() &&
+         HashTestSetSources(input_file, output_file, &source_hash) &&
+         ViewTestSetImage(image->view(), source_hash, image, ViewF, input,
+                          output);
+}
+
+// Creates dir, accessible to the current user only, unless it exists.
+// Returns whether it is such a directory: one that another user created first
+// or opened up would let them plant, replace or hold the files in it.
+bool MakePrivateDir(const string& dir) {
+  mkdir(dir.c_str(), 0700);
+  struct stat st;
+  return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+         st.st_uid == geteuid() && (st.st_mode & 077) == 0;
+}
+
+// Shared test sets: test set images published once per host in POSIX shared
+// memory and served read-only, in place, to every judge process of the same
+// user. Each image lives in a segment named after the user and its source
+// hash, with a lock file of the same name in the user's private
+// SharedTestSetLockDir(). Publishing holds the lock exclusively; judges hold
+// it shared for as long as they use the segment, so any number of them attach
+// at once, and the kernel releases it even if a judge dies. A segment is idle
+// when the lock can be taken exclusively, and only idle segments are evicted,
+// with their lock files, least recently attached first, when the published
+// total exceeds the host budget.
+const char kSharedTestSetDir[] = "/dev/shm";
+// Prefix of every segment name. Tests use one of their own, so they neither
+// see nor evict the user's real test sets.
+string shared_test_set_prefix = "cj-testset-";
+
+// Prefix of the segments of the current user.
+string SharedTestSetUserPrefix() {
+  return shared_test_set_prefix + Strint(geteuid()) + "-";
+}
+
+string SharedTestSetName(uint64_t source_hash) {
+  char hash[32];
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)source_hash);
+  return SharedTestSetUserPrefix() + hash;
+}
+
+// Lock files of the current user's segments. Not a segment name: those have
+// no '.'.
+string SharedTestSetLockDir() {
+  return string(kSharedTestSetDir) + "/" + shared_test_set_prefix +
+         Strint(geteuid()) + ".locks";
+}
+
+string SharedTestSetLockFile(const string& name) {
+  return SharedTestSetLockDir() + "/" + name;
+}
+
+// Opens the lock file of the segment name, creating it if needed, and locks
+// it with flock(fd, operation). Returns the locked file, or -1. Eviction
+// unlinks lock files, so a lock that was taken on a file unlinked meanwhile
+// is dropped and taken again on the current one.
+int LockSharedTestSet(const string& name, int operation) {
+  if (!MakePrivateDir(SharedTestSetLockDir())) return -1;
+  const string lock_file = SharedTestSetLockFile(name);
+  for (;;) {
+    const int fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+    if (fd < 0) return -1;
+    if (flock(fd, operation) != 0) {
+      close(fd);
+      return -1;
+    }
+    struct stat fd_st, path_st;
+    if (fstat(fd, &fd_st) == 0 && stat(lock_file.c_str(), &path_st) == 0 &&
+        fd_st.st_dev == path_st.st_dev && fd_st.st_ino == path_st.st_ino)
+      return fd;
+    close(fd);
+  }
+}
+
+// Unlinks the segment name and its lock file if the segment is idle.
+bool EvictSharedTestSet(const string& name) {
+  const int lock_fd = LockSharedTestSet(name, LOCK_EX | LOCK_NB);
+  if (lock_fd < 0) return false;
+  const bool evicted = shm_unlink(("/" + name).c_str()) == 0;
+  // Unlinked while still locked, so judges waiting for this lock retry on a
+  // new file.
+  unlink(SharedTestSetLockFile(name).c_str());
+  close(lock_fd);
+  return evicted;
+}
+
+// Unlinks the current user's idle shared test sets other than keep, least
+// recently attached first, until the remaining ones take at most budget_bytes.
+void EvictSharedTestSets(uint64_t budget_bytes, const string& keep = "") {
+  struct Segment {
+    int64_t last_attach;
+    uint64_t size;
+    string name;
+    bool operator<(const Segment& o) const {
+      return last_attach < o.last_attach;
+    }
+  };
+  const string prefix = SharedTestSetUserPrefix();
+  vector<Segment> segments;
+  uint64_t total = 0;
+  error_code ec;
+  for (const auto& entry :
+       filesystem::directory_iterator(kSharedTestSetDir, ec)) {
+    const string name = entry.path().filename().string();
+    if (name.rfind(prefix, 0) != 0 || name.find('.') != string::npos)
+      continue;
+    struct stat segment_st, lock_st;
+    if (stat(entry.path().c_str(), &segment_st) != 0 ||
+        segment_st.st_uid != geteuid())
+      continue;
+    if (stat(SharedTestSetLockFile(name).c_str(), &lock_st) != 0)
+      lock_st.st_mtime = 0;
+    total += segment_st.st_size;
+    if (name != keep)
+      segments.push_back({lock_st.st_mtime, (uint64_t)segment_st.st_size, name});
+  }
+  sort(segments.begin(), segments.end());
+  for (const Segment& segment : segments) {
+    if (total <= budget_bytes) break;
+    if (EvictSharedTestSet(segment.name)) total -= segment.size;
+  }
+}
+
+// Read-only attachment to a shared test set image, holding the segment's lock
+// shared while attached. Detaches on destruction.
+class SharedTestSet {
+ public:
+  SharedTestSet() = default;
+  ~SharedTestSet() { Detach(); }
+  SharedTestSet(const SharedTestSet&) = delete;
+  SharedTestSet& operator=(const SharedTestSet&) = delete;
+
+  // Attaches to the segment for source_hash. If there is no valid one, calls
+  // build() for the image, evicts idle segments to make room for it within
+  // budget_bytes, and publishes it.
+  bool Attach(uint64_t source_hash, const function<string()>& build,
+              uint64_t budget_bytes) {
+    const string name = SharedTestSetName(source_hash);
+    // Usually the segment is published already, and the shared lock, which
+    // any number of judges hold at once, is enough to map and check it.
+    lock_fd_ = LockSharedTestSet(name, LOCK_SH);
+    if (lock_fd_ < 0) return false;
+    futimens(lock_fd_, nullptr);
+    if (MapValid(name, source_hash)) return true;
+    // Another judge may publish the segment between dropping the shared lock
+    // and taking the exclusive one: check it again.
+    close(lock_fd_);
+    lock_fd_ = LockSharedTestSet(name, LOCK_EX);
+    if (lock_fd_ < 0) return false;
+    if (!MapValid(name, source_hash)) {
+      const string image = build();
+      EvictSharedTestSets(
+          budget_bytes > image.size() ? budget_bytes - image.size() : 0, name);
+      if (!Publish(name, image) || !MapValid(name, source_hash)) return false;
+    }
+    // Shared again, so that other judges attach while this one is attached.
+    return flock(lock_fd_, LOCK_SH) == 0;
+  }
+
+  // Unmaps the segment and drops the lock, so that the segment can be
+  // evicted again.
+  void Detach() {
+    Unmap();
+    if (lock_fd_ >= 0) close(lock_fd_);
+    lock_fd_ = -1;
+  }
+
+  string_view image() const { return string_view(data_, size_); }
+
+ private:
+  // Maps the segment name if it holds a valid image for source_hash.
+  bool MapValid(const string& name, uint64_t source_hash) {
+    string_view payload;
+    if (Map(name) && OpenTestSetImage(image(), source_hash, &payload))
+      return true;
+    Unmap();
+    return false;
+  }
+
+  // Maps the segment name if the current user owns it.
+  bool Map(const string& name) {
+    const int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_uid == geteuid() && st.st_size > 0) {
+      void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        data_ = static_cast<const char*>(p);
+        size_ = st.st_size;
+      }
+    }
+    close(fd);
+    return data_ != nullptr;
+  }
+
+  void Unmap() {
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  static bool Publish(const string& name, const string& image) {
+    const int fd =
+        shm_open(("/" + name).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+    bool ok = ftruncate(fd, image.size()) == 0;
+    for (size_t done = 0; ok && done < image.size();) {
+      const ssize_t n = write(fd, image.data() + done, image.size() - done);
+      ok = n > 0;
+      done += max<ssize_t>(n, 0);
+    }
+    close(fd);
+    if (!ok) shm_unlink(("/" + name).c_str());
+    return ok;
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  int lock_fd_ = -1;
+};
+
+// Serves a test set in place from its shared segment, publishing it first
+// from cache_file if that is up to date, or else from the text sources. The
+// cases stay attached to the segment until the last copy of them is gone.
+template <typename T, typename U>
+bool LoadSharedTestSet(const string& input_file, const string& output_file,
+                       const string& cache_file, uint64_t budget_bytes,
+                       T ParseCaseInputF(istream&),
+                       U ParseCaseOutputF(const vector<vector<string>>&),
+                       void EncodeF(const vector<T>&, const vector<U>&,
+                                    BinaryWriter&),
+                       bool ViewF(BinaryReader&, TestSetCases<T>*,
+                                  TestSetCases<U>*),
+                       TestSetCases<T>* input, TestSetCases<U>* output) {
+  uint64_t source_hash;
+  if (!HashTestSetSources(input_file, output_file, &source_hash)) return false;
+  auto build = [&]() {
+    MappedFile cached(cache_file);
+    string_view payload;
+    if (cached.ok() && OpenTestSetImage(cached.view(), source_hash, &payload))
+      return string(cached.view());
+    return CompileTestSetImage(input_file, output_file, source_hash,
+                               ParseCaseInputF, ParseCaseOutputF, EncodeF);
+  };
+  const auto segment = make_shared<SharedTestSet>();
+  return segment->Attach(source_hash, build, budget_bytes) &&
+         ViewTestSetImage(segment->image(), source_hash, segment, ViewF, input,
+                          output);
+}
+
+void TestSharedTestSet() {
+  const string saved_prefix = shared_test_set_prefix;
+  shared_test_set_prefix = "cj-testset-test" + Strint(getpid()) + "-";
+  const uint64_t hash = Mix64(getpid() ^ (uint64_t)time(nullptr) << 20);
+  const string name = SharedTestSetName(hash);
+  const string image = BuildTestSetImage(hash, "payload");
+  int built[2];
+  assert(pipe(built) == 0);
+  // Attaches in a child process, counting builds through the pipe.
+  auto attach_in_child = [&](int64_t build_us) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      SharedTestSet segment;
+      const bool ok = segment.Attach(
+          hash,
+          [&] {
+            assert(write(built[1], "b", 1) == 1);
+            usleep(build_us);
+            return image;
+          },
+          1 << 30);
+      _exit(ok && segment.image() == image ? 0 : 1);
+    }
+    return pid;
+  };
+  auto exit_status = [](pid_t pid) {
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  };
+  // Two judges attaching at once: one publishes, and the other waits for it.
+  const pid_t first = attach_in_child(100000);
+  const pid_t second = attach_in_child(100000);
+  assert(exit_status(first) == 0 && exit_status(second) == 0);
+  close(built[1]);
+  char buffer[4];
+  assert(read(built[0], buffer, sizeof(buffer)) == 1);
+  close(built[0]);
+  // A judge attached to a published segment does not block another one.
+  SharedTestSet segment;
+  assert(segment.Attach(hash, [] { return string(); }, 1 << 30));
+  assert(segment.image() == image);
+  const int64_t start = time(nullptr);
+  const pid_t third = fork();
+  if (third == 0) {
+    SharedTestSet other;
+    _exit(other.Attach(hash, [] { return string(); }, 1 << 30) ? 0 : 1);
+  }
+  assert(exit_status(third) == 0 && time(nullptr) - start < 5);
+  // Only the owner can use the lock directory.
+  struct stat st;
+  assert(stat(SharedTestSetLockDir().c_str(), &st) == 0 &&
+         (st.st_mode & 0777) == 0700);
+  // The segment stays while it is attached, and is evicted with its lock file
+  // once it is not.
+  assert(!EvictSharedTestSet(name));
+  segment.Detach();
+  assert(segment.image().empty());
+  assert(EvictSharedTestSet(name));
+  assert(access(SharedTestSetLockFile(name).c_str(), F_OK) != 0);
+  const int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+  assert(fd < 0);
+  assert(rmdir(SharedTestSetLockDir().c_str()) == 0);
+  shared_test_set_prefix = saved_prefix;
+}
+
+void TestMakePrivateDir() {
+  const string dir = "/tmp/private_dir_test_" + Strint(getpid());
+  assert(MakePrivateDir(dir) && MakePrivateDir(dir));
+  chmod(dir.c_str(), 0755);
+  assert(!MakePrivateDir(dir));
+  rmdir(dir.c_str());
+  symlink("/tmp", dir.c_str());
+  assert(!MakePrivateDir(dir));
+  unlink(dir.c_str());
+}
+
+// Counters reported with --stats.
+struct JudgeStats {
+  atomic<uint64_t> verdict_cache_hits{0};
+  atomic<uint64_t> verdict_cache_misses{0};
+};
+
+JudgeStats judge_stats;
+
+void ReportStats(ostream& out) {
+  out << "verdict_cache_hits: " << judge_stats.verdict_cache_hits << "\n"
+      << "verdict_cache_misses: " << judge_stats.verdict_cache_misses << endl;
+  ReportSimdKernels(out);
+}
+
+// Verdicts of individual cases keyed by CaseVerdictKey, kept in memory and
+// optionally in an append-only file of "<key in hex> <verdict>" lines shared
+// by all judges that use it. Each line is appended with a single write, so
+// concurrent judges do not interleave entries.
+class VerdictCache {
+ public:
+  VerdictCache() = default;
+  // Backed by filename, or in memory only if it is empty.
+  explicit VerdictCache(const string& filename) {
+    if (filename.empty()) return;
+    ifstream in(filename);
+    string line;
+    while (getline(in, line)) {
+      uint64_t key;
+      string verdict;
+      if (ParseLine(line, &key, &verdict)) verdicts_[key] = verdict;
+    }
+    fd_ = open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  }
+  ~VerdictCache() {
+    if (fd_ >= 0) close(fd_);
+  }
+  VerdictCache(const VerdictCache&) = delete;
+  VerdictCache& operator=(const VerdictCache&) = delete;
+
+  const string* Find(uint64_t key) const {
+    lock_guard<mutex> lock(mu_);
+    auto it = verdicts_.find(key);
+    return it == verdicts_.end() ? nullptr : &it->second;
+  }
+
+  void Put(uint64_t key, const string& verdict) {
+    lock_guard<mutex> lock(mu_);
+    if (!verdicts_.emplace(key, verdict).second || fd_ < 0) return;
+    const string line = FormatLine(key, verdict);
+    if (write(fd_, line.data(), line.size()) != (ssize_t)line.size()) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  static string FormatLine(uint64_t key, const string& verdict) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+    return string(hex) + " " + verdict + "\n";
+  }
+
+  static bool ParseLine(const string& line, uint64_t* key, string* verdict) {
+    if (line.size() < 17 || line[16] != ' ') return false;
+    const string hex = line.substr(0, 16);
+    char* end;
+    *key = strtoull(hex.c_str(), &end, 16);
+    if (*end != '\0') return false;
+    *verdict = line.substr(17);
+    return true;
+  }
+
+ private:
+  mutable mutex mu_;
+  unordered_map<uint64_t, string> verdicts_;
+  int fd_ = -1;
+};
+
+// Version of the cached verdicts. Bump it whenever a change to the judge can
+// change the verdict of a case, so that older entries no longer match.
+const uint64_t kVerdictCacheVersion = 1;
+
+// Seed for the verdict keys of one problem's test set.
+uint64_t VerdictKeySeed(const string& problem, uint64_t test_set_hash) {
+  return Mix64(HashBytes(problem, kVerdictCacheVersion) ^ test_set_hash);
+}
+
+// Key of the verdict for one case of a test set, given the attempt's tokens for
+// that case. Tokens are already lowercased; whitespace is normalized to one
+// space between tokens and one newline per line.
+template <typename Lines>
+uint64_t CaseVerdictKeyOf(uint64_t seed, size_t case_index,
+                          const Lines& lines) {
+  string normalized;
+  for (size_t j = 0; j < lines.size(); ++j) {
+    for (size_t i = 0; i < lines[j].size(); ++i) {
+      normalized += lines[j][i];
+      normalized += ' ';
+    }
+    normalized += '\n';
+  }
+  return HashBytes(normalized, Mix64(seed + case_index));
+}
+
+uint64_t CaseVerdictKey(uint64_t seed, size_t case_index,
+                        const vector<vector<string>>& lines) {
+  return CaseVerdictKeyOf(seed, case_index, lines);
+}
+
+uint64_t CaseVerdictKey(uint64_t seed, size_t case_index,
+                        const TokenCase& lines) {
+  return CaseVerdictKeyOf(seed, case_index, lines);
+}
+
+void TestVerdictCache() {
+  const uint64_t seed = VerdictKeySeed("problem", 1);
+  assert(seed != VerdictKeySeed("problem", 2));
+  assert(seed != VerdictKeySeed("other", 1));
+  const uint64_t key = CaseVerdictKey(seed, 0, {{"1", "2"}});
+  assert(key == CaseVerdictKey(seed, 0, {{"1", "2"}}));
+  assert(key != CaseVerdictKey(seed, 1, {{"1", "2"}}));
+  assert(key != CaseVerdictKey(seed, 0, {{"1"}, {"2"}}));
+  assert(key != CaseVerdictKey(seed, 0, {{"12"}}));
+  VerdictCache cache;
+  assert(cache.Find(key) == nullptr);
+  cache.Put(key, "bad");
+  cache.Put(key, "ignored");
+  assert(cache.Find(key) != nullptr && *cache.Find(key) == "bad");
+  uint64_t parsed_key;
+  string verdict;
+  assert(VerdictCache::ParseLine("00000000000000ff x y", &parsed_key, &verdict));
+  assert(parsed_key == 255 && verdict == "x y");
+  assert(VerdictCache::ParseLine("00000000000000ff ", &parsed_key, &verdict));
+  assert(verdict == "");
+  assert(VerdictCache::FormatLine(255, "x y") == "00000000000000ff x y\n");
+  assert(!VerdictCache::ParseLine("00000000000000fg x", &parsed_key, &verdict));
+  assert(!VerdictCache::ParseLine("ff x", &parsed_key, &verdict));
+}
+
+// Attempt output parsed through a VerdictCache. Cases with a cached verdict
+// are not parsed: their entry in cases is default constructed and verdicts
+// points at the cached verdict instead.
+template <typename U>
+struct CachedAttempt {
+  vector<U> cases;
+  vector<uint64_t> keys;
+  vector<const string*> verdicts;
+};
+
+// Like ParseAllOutput, skipping ParseCaseOutputF for cases whose verdict is
+// in the cache. Only the first num_input_cases cases can be cached.
+template <typename ParseCaseOutputF>
+CachedAttempt<ParsedCaseOutput<ParseCaseOutputF>> ParseAllOutputCached(
+    const string& filename, ParseCaseOutputF ParseCaseOutput,
+    size_t num_input_cases, uint64_t key_seed, const VerdictCache& cache) {
+  const FileContents file(filename);
+  CheckOutputText(file.view());
+  if (Failed()) return {};
+  const TokenTable table =
+      TokenizeCases(file.view(), 1, TokenizeThreadsFor(file.view().size()));
+  CachedAttempt<ParsedCaseOutput<ParseCaseOutputF>> r;
+  if (Failed()) return r;
+  r.cases.resize(table.num_cases());
+  r.keys.resize(table.num_cases());
+  r.verdicts.resize(table.num_cases());
+  for (size_t i = 0; i < table.num_cases(); ++i) {
+    const TokenCase lines(table, i);
+    CheckDeadline();
+    if (Failed()) return CachedAttempt<ParsedCaseOutput<ParseCaseOutputF>>();
+    if (i < num_input_cases) {
+      r.keys[i] = CaseVerdictKey(key_seed, i, lines);
+      r.verdicts[i] = cache.Find(r.keys[i]);
+      ++(r.verdicts[i] ? judge_stats.verdict_cache_hits
+                       : judge_stats.verdict_cache_misses);
+    }
+    if (!r.verdicts[i]) r.cases[i] = ParseTokenCase(ParseCaseOutput, lines);
+    if (Failed()) return CachedAttempt<ParsedCaseOutput<ParseCaseOutputF>>();
+  }
+  return r;
+}
+
+// Verdict of case i of an attempt parsed with ParseAllOutputCached, caching
+// it if it was not cached yet.
+template <typename Inputs, typename Outputs, typename U, typename JudgeCaseF>
+string JudgeCaseCached(const Inputs& input, const Outputs& correct_output,
+                       const CachedAttempt<U>& attempt, size_t i,
+                       JudgeCaseF JudgeCase, VerdictCache* cache) {
+  if (attempt.verdicts[i]) return *attempt.verdicts[i];
+  string e =
+      RenderCaseVerdict(JudgeCase(input[i], correct_output[i], attempt.cases[i]));
+  if (Failed()) return "";
+  cache->Put(attempt.keys[i], e);
+  return e;
+}
+
+// Like JudgeAllCases, using cached verdicts where available and caching the
+// verdicts it computes.
+template <typename Inputs, typename Outputs, typename U, typename JudgeCaseF>
+string JudgeAllCasesCached(const Inputs& input, const Outputs& correct_output,
+                           const CachedAttempt<U>& attempt,
+                           JudgeCaseF JudgeCase, VerdictCache* cache) {
+  CheckNumberOfCases(attempt.cases.size(), input.size());
+  if (Failed()) return "";
+  size_t next_case = 0;
+  string verdict;
+  JudgeCasesFrom(
+      input.size(),
+      [&](size_t i) {
+        return JudgeCaseCached(input, correct_output, attempt, i, JudgeCase,
+                               cache);
+      },
+      [] { return false; }, &next_case, &verdict);
+  return verdict;
+}
+
+string ParseCaseOutputTest(const vector<vector<string>>& lines) {
+  if (lines.size() != 1 || lines[0].size() != 1) {
+    Error("Bad test output");
+    return "";
+  }
+  return lines[0][0];
+}
+
+string JudgeCaseStringTest(const int& n, const string& m, const string& o) {
+  return o == m ? "" : o + " is not " + m;
+}
+
+void TestJudgeAllCasesCached() {
+  const string filename = "/tmp/verdict_cache_test_" + Strint(getpid());
+  ofstream(filename) << "Case #1: a\nCase #2: b\nCase #3: c\n";
+  VerdictCache cache;
+  const uint64_t seed = VerdictKeySeed("test", 0);
+  const uint64_t hits = judge_stats.verdict_cache_hits;
+  const uint64_t misses = judge_stats.verdict_cache_misses;
+  auto first = ParseAllOutputCached(filename, ParseCaseOutputTest, 3, seed, cache);
+  assert(Eq(first.cases, {"a", "b", "c"}));
+  assert(JudgeAllCasesCached(vector<int>({1, 2, 3}),
+                             vector<string>({"a", "x", "c"}), first,
+                             JudgeCaseStringTest, &cache) ==
+         "Case #2: b is not x");
+  assert(judge_stats.verdict_cache_misses == misses + 3);
+  auto second =
+      ParseAllOutputCached(filename, ParseCaseOutputTest, 3, seed, cache);
+  assert(judge_stats.verdict_cache_hits == hits + 2);
+  assert(Eq(second.cases, {"", "", "c"}));
+  // The cached verdict wins even when the correct output disagrees.
+  assert(JudgeAllCasesCached(vector<int>({1, 2, 3}),
+                             vector<string>({"a", "b", "c"}), second,
+                             JudgeCaseStringTest, &cache) ==
+         "Case #2: b is not x");
+  AssertError(JudgeAllCasesCached(vector<int>({1, 2}),
+                                  vector<string>({"a", "b"}), second,
+                                  JudgeCaseStringTest, &cache),
+              "Wrong number of cases in attempt: 3, expected: 2");
+  remove(filename.c_str());
+}
+
+void TestCatchError() {
+  string error;
+  assert(CatchError([] {}, &error) && error.empty());
+  assert(!CatchError([] { ParseInt("x"); }, &error));
+  assert(error == "Not an integer in range: x");
+  assert(!mocked_error && !error_raised && last_error.empty());
+  assert(!CatchError(
+      [] {
+        Error("first");
+        Error("second");
+      },
+      &error));
+  assert(error == "first");
+}
+
+// Orders queued judge jobs by priority class (lower is more urgent), then by
+// estimated cost, then by arrival. A job is admitted the first time it runs if
+// its estimated memory fits under the in-flight cap, or if nothing else is in
+// flight; jobs behind the first one that does not fit wait for it, so large
+// jobs are not starved. Admitted jobs keep their memory until they finish, and
+// may yield at case boundaries when more urgent runnable work is queued, to be
+// resumed later by any worker.
+class JudgeScheduler {
+ public:
+  explicit JudgeScheduler(uint64_t max_inflight_memory)
+      : max_inflight_memory_(max_inflight_memory) {}
+
+  void Add(size_t id, int priority, uint64_t cost, uint64_t memory) {
+    lock_guard<mutex> lock(mu_);
+    if (jobs_.size() <= id) jobs_.resize(id + 1);
+    jobs_[id] = {priority, cost, memory, false};
+    queue_.insert(Key(id));
+    ++pending_;
+    UpdateUrgentPriority();
+    cv_.notify_one();
+  }
+
+  // Blocks until a queued job may run and returns it in id, or returns false
+  // once every job has finished.
+  bool Next(size_t* id) {
+    unique_lock<mutex> lock(mu_);
+    while (pending_ > 0) {
+      auto it = FindRunnable();
+      if (it != queue_.end()) {
+        *id = get<2>(*it);
+        queue_.erase(it);
+        Job& job = jobs_[*id];
+        if (!job.admitted) inflight_memory_ += job.memory;
+        job.admitted = true;
+        UpdateUrgentPriority();
+        return true;
+      }
+      cv_.wait(lock);
+    }
+    return false;
+  }
+
+  // Whether a running job of the given priority should yield to more urgent
+  // queued work. Lock-free, as it is asked at every case boundary.
+  bool ShouldYield(int priority) const {
+    return urgent_priority_.load(memory_order_relaxed) < priority;
+  }
+
+  // Puts a running job back in the queue, keeping its admitted memory.
+  void Yield(size_t id) {
+    lock_guard<mutex> lock(mu_);
+    queue_.insert(Key(id));
+    UpdateUrgentPriority();
+    cv_.notify_all();
+  }
+
+  void Finish(size_t id) {
+    lock_guard<mutex> lock(mu_);
+    inflight_memory_ -= jobs_[id].memory;
+    --pending_;
+    UpdateUrgentPriority();
+    cv_.notify_all();
+  }
+
+  uint64_t inflight_memory() {
+    lock_guard<mutex> lock(mu_);
+    return inflight_memory_;
+  }
+
+ private:
+  struct Job {
+    int priority;
+    uint64_t cost;
+    uint64_t memory;
+    bool admitted;
+  };
+  typedef tuple<int, uint64_t, size_t> QueueKey;
+
+  QueueKey Key(size_t id) const {
+    return QueueKey(jobs_[id].priority, jobs_[id].cost, id);
+  }
+
+  set<QueueKey>::iterator FindRunnable() {
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+      const Job& job = jobs_[get<2>(*it)];
+      if (job.admitted) return it;
+      if (inflight_memory_ == 0 ||
+          inflight_memory_ + job.memory <= max_inflight_memory_)
+        return it;
+      // Nothing new may pass a job waiting for memory; resumed jobs still run.
+      for (++it; it != queue_.end(); ++it)
+        if (jobs_[get<2>(*it)].admitted) return it;
+      break;
+    }
+    return queue_.end();
+  }
+
+  void UpdateUrgentPriority() {
+    auto it = FindRunnable();
+    urgent_priority_ = it == queue_.end() ? INT_MAX : get<0>(*it);
+  }
+
+  mutex mu_;
+  condition_variable cv_;
+  vector<Job> jobs_;
+  set<QueueKey> queue_;
+  size_t pending_ = 0;
+  uint64_t inflight_memory_ = 0;
+  const uint64_t max_inflight_memory_;
+  // Priority of the job Next would return, or INT_MAX if none.
+  atomic<int> urgent_priority_{INT_MAX};
+};
+
+void TestJudgeScheduler() {
+  JudgeScheduler scheduler(100);
+  scheduler.Add(0, 1, 50, 60);
+  scheduler.Add(1, 0, 90, 60);
+  scheduler.Add(2, 1, 10, 30);
+  scheduler.Add(3, 0, 5, 10);
+  size_t id;
+  assert(scheduler.Next(&id) && id == 3);
+  assert(scheduler.Next(&id) && id == 1);
+  assert(scheduler.inflight_memory() == 70);
+  // Job 2 fits but may not pass job 0, which is waiting for memory.
+  assert(!scheduler.ShouldYield(0));
+  scheduler.Finish(3);
+  scheduler.Finish(1);
+  assert(scheduler.Next(&id) && id == 2);
+  assert(scheduler.Next(&id) && id == 0);
+  assert(scheduler.inflight_memory() == 90);
+  scheduler.Add(4, 0, 1, 1000);
+  assert(!scheduler.ShouldYield(1));
+  scheduler.Add(5, 0, 1, 5);
+  assert(!scheduler.ShouldYield(1));  // Job 4 heads the queue and does not fit.
+  scheduler.Finish(2);
+  assert(!scheduler.ShouldYield(1));
+  scheduler.Finish(0);
+  assert(scheduler.Next(&id) && id == 4);  // Admitted alone despite the cap.
+  assert(!scheduler.ShouldYield(0));
+  scheduler.Add(6, 1, 1, 0);
+  scheduler.Finish(4);
+  assert(scheduler.Next(&id) && id == 5);
+  scheduler.Add(7, 2, 1, 0);
+  assert(scheduler.Next(&id) && id == 6);
+  assert(scheduler.Next(&id) && id == 7);
+  scheduler.Add(8, 0, 1, 0);
+  assert(scheduler.ShouldYield(2) && !scheduler.ShouldYield(0));
+  scheduler.Yield(7);
+  assert(scheduler.Next(&id) && id == 8);
+  assert(scheduler.Next(&id) && id == 7);  // Resumed.
+  for (size_t done : {5, 6, 7, 8}) scheduler.Finish(done);
+  assert(!scheduler.Next(&id));
+  assert(scheduler.inflight_memory() == 0);
+}
+
+// Rough peak memory of tokenizing and parsing an attempt, per byte of it.
+const uint64_t kJudgeMemoryPerAttemptByte = 24;
+
+// A test set loaded for batch judging.
+template <typename T, typename U>
+struct LoadedTestSet {
+  TestSetCases<T> input;
+  TestSetCases<U> correct_output;
+  uint64_t key_seed = 0;
+  // Estimated cost of judging an attempt, not counting reading it.
+  uint64_t cost = 0;
+};
+
+// Sum of the estimated costs of judging each case of a test set.
+template <typename T>
+uint64_t EstimateTestSetCost(const TestSetCases<T>& input,
+                             uint64_t EstimateCaseCostF(const T&)) {
+  uint64_t cost = 0;
+  for (size_t i = 0; i < input.size(); ++i) cost += EstimateCaseCostF(input[i]);
+  return cost;
+}
+
+// One line of a batch list:
+//   ATTEMPT[<tab>PRIORITY[<tab>INPUT<tab>OUTPUT[<tab>PLUGIN]]].
+// Without a test set or plugin, the batch's default one is used.
+struct BatchEntry {
+  string attempt_file;
+  int priority = 0;
+  string input_file;
+  string output_file;
+  string plugin_file;
+};
+
+BatchEntry ParseBatchEntry(const string& line) {
+  vector<string> fields;
+  for (size_t begin = 0, end; begin <= line.size(); begin = end + 1) {
+    end = min(line.find('\t', begin), line.size());
+    fields.push_back(line.substr(begin, end - begin));
+  }
+  BatchEntry entry;
+  if (fields.size() != 1 && fields.size() != 2 && fields.size() != 4 &&
+      fields.size() != 5) {
+    Error("Bad batch line: " + Truncate(line));
+    return entry;
+  }
+  entry.attempt_file = fields[0];
+  if (fields.size() >= 2) entry.priority = ParseInt(fields[1]);
+  if (fields.size() >= 4) {
+    entry.input_file = fields[2];
+    entry.output_file = fields[3];
+  }
+  if (fields.size() == 5) entry.plugin_file = fields[4];
+  return entry;
+}
+
+void TestParseBatchEntry() {
+  BatchEntry e = ParseBatchEntry("a b");
+  assert(e.attempt_file == "a b" && e.priority == 0 && e.input_file.empty());
+  e = ParseBatchEntry("a\t-3");
+  assert(e.attempt_file == "a" && e.priority == -3);
+  e = ParseBatchEntry("a\t2\tin\tout");
+  assert(e.priority == 2 && e.input_file == "in" && e.output_file == "out");
+  assert(e.plugin_file.empty());
+  e = ParseBatchEntry("a\t2\tin\tout\tp.so");
+  assert(e.output_file == "out" && e.plugin_file == "p.so");
+  AssertError(ParseBatchEntry("a\t1\tin"), "Bad batch line: a\t1\tin");
+  AssertError(ParseBatchEntry("a\tx"), "Not an integer in range: x");
+}
+
+// Reads the non-empty lines of a file, or of stdin for "-".
+vector<string> ReadFileList(const string& filename) {
+  const int fd = OpenInputFile(filename);
+  LineReader reader(fd);
+  vector<string> r;
+  for (string_view line; reader.Next(&line);)
+    if (!line.empty()) r.emplace_back(line);
+  if (fd >= 0) close(fd);
+  return r;
+}
+
+// One line of batch output: the attempt file and its verdict, tab separated.
+// Accepted attempts read "OK"; rejected ones "REJECTED" and the message the
+// single-attempt judge would print; ones the judge ran out of CPU time on
+// "JUDGE_TIME_LIMIT".
+string FormatBatchVerdict(const string& attempt_file, bool ok,
+                          const string& error) {
+  if (!ok && error == kJudgeTimeLimitError)
+    return attempt_file + "\tJUDGE_TIME_LIMIT";
+  return attempt_file + (ok ? "\tOK" : "\tREJECTED\t" + error);
+}
+
+// Judges every batch entry against its test set, test_sets[i] for entries[i],
+// on num_threads threads, through cache. ParseCaseOutput(i, lines) parses a
+// case of entries[i] and JudgeCase(i, input, correct_output, attempt) judges
+// one, so entries may belong to different problems if T and U allow it.
+// Jobs are scheduled by JudgeScheduler
+// on their priority and on a cost estimated from the attempt size and the
+// test set cost, with at most max_inflight_memory bytes of estimated memory in
+// flight. Each attempt gets the CPU budgets in budgets, counted across the
+// times it is resumed. Writes one FormatBatchVerdict line per entry to out as
+// soon as it is judged, so urgent attempts are not held back by earlier ones.
+template <typename T, typename U, typename ParseCaseOutputF,
+          typename JudgeCaseF>
+void JudgeBatch(const vector<BatchEntry>& entries,
+                const vector<const LoadedTestSet<T, U>*>& test_sets,
+                ParseCaseOutputF ParseCaseOutput, JudgeCaseF JudgeCase,
+                VerdictCache* cache, int num_threads,
+                uint64_t max_inflight_memory, const JudgeBudgets& budgets,
+                ostream& out) {
+  struct Job {
+    bool parsed = false;
+    CachedAttempt<U> attempt;
+    size_t next_case = 0;
+    int64_t cpu_ns = 0;
+  };
+  vector<Job> jobs(entries.size());
+  JudgeScheduler scheduler(max_inflight_memory);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    struct stat st;
+    const uint64_t size =
+        stat(entries[i].attempt_file.c_str(), &st) == 0 ? st.st_size : 0;
+    scheduler.Add(i, entries[i].priority, size + test_sets[i]->cost,
+                  size * kJudgeMemoryPerAttemptByte);
+  }
+  mutex out_mu;
+  auto worker = [&]() {
+    case_cpu_budget_ns = budgets.case_ns;
+    for (size_t i; scheduler.Next(&i);) {
+      const LoadedTestSet<T, U>& test_set = *test_sets[i];
+      Job& job = jobs[i];
+      bool finished = true;
+      string error;
+      const int64_t start_ns = JudgeCpuTimeNs();
+      ScopedDeadline deadline(
+          budgets.run_ns == 0 ? 0 : max<int64_t>(1, budgets.run_ns - job.cpu_ns));
+      const bool ok = CatchError(
+          [&] {
+            if (!job.parsed) {
+              job.attempt = ParseAllOutputCached(
+                  entries[i].attempt_file,
+                  [&](const auto& lines)
+                      -> decltype(ParseCaseOutput(i, lines)) {
+                    return ParseCaseOutput(i, lines);
+                  },
+                  test_set.input.size(), test_set.key_seed, *cache);
+              if (Failed()) return;
+              job.parsed = true;
+              CheckNumberOfCases(job.attempt.cases.size(),
+                                 test_set.input.size());
+              if (Failed()) return;
+            }
+            finished = JudgeCasesFrom(
+                test_set.input.size(),
+                [&](size_t c) {
+                  return JudgeCaseCached(
+                      test_set.input, test_set.correct_output, job.attempt, c,
+                      [&](const T& input, const U& correct_output,
+                          const U& attempt) {
+                        return JudgeCase(i, input, correct_output, attempt);
+                      },
+                      cache);
+                },
+                [&] { return scheduler.ShouldYield(entries[i].priority); },
+                &job.next_case,
+                &error);
+          },
+          &error) && error.empty();
+      job.cpu_ns += JudgeCpuTimeNs() - start_ns;
+      if (!finished) {
+        scheduler.Yield(i);
+        continue;
+      }
+      job.attempt = CachedAttempt<U>();
+      scheduler.Finish(i);
+      lock_guard<mutex> lock(out_mu);
+      out << FormatBatchVerdict(entries[i].attempt_file, ok, error) << endl;
+    }
+  };
+  vector<thread> threads;
+  for (int i = 1; i < num_threads; ++i) threads.emplace_back(worker);
+  // The calling thread works too, so it gets its own case budget back.
+  const int64_t caller_case_cpu_budget_ns = case_cpu_budget_ns;
+  worker();
+  case_cpu_budget_ns = caller_case_cpu_budget_ns;
+  for (thread& t : threads) t.join();
+}
+
+void TestJudgeBatch() {
+  const string prefix = "/tmp/judge_batch_test_" + Strint(getpid());
+  const vector<string> contents = {"Case #1: a\nCase #2: b\n",
+                                   "Case #1: a\nCase #2: c\n",
+                                   "Case #1: a\n", "Case #2: a\n",
+                                   "Case #1: a\nCase #2: b\n"};
+  vector<BatchEntry> entries;
+  for (size_t i = 0; i < contents.size(); ++i) {
+    entries.push_back(ParseBatchEntry(prefix + "_" + Strint(i) + "\t" +
+                                      Strint(i % 3)));
+    ofstream(entries.back().attempt_file) << contents[i];
+  }
+  entries.push_back(ParseBatchEntry(prefix + "_missing"));
+  LoadedTestSet<int, string> test_set;
+  test_set.input = vector<int>({1, 2});
+  test_set.correct_output = vector<string>({"a", "b"});
+  const vector<const LoadedTestSet<int, string>*> test_sets(entries.size(),
+                                                             &test_set);
+  auto name = [&](int i) { return entries[i].attempt_file; };
+  vector<string> expected = {
+      name(0) + "\tOK",
+      name(1) + "\tREJECTED\tCase #2: c is not b",
+      name(2) + "\tREJECTED\tWrong number of cases in attempt: 1, expected: 2",
+      name(3) + "\tREJECTED\tFound case: 2, expected: 1",
+      name(4) + "\tOK",
+      name(5) + "\tREJECTED\tWrong number of cases in attempt: 0, expected: 2"};
+  sort(expected.begin(), expected.end());
+  for (int threads : {1, 4}) {
+    for (uint64_t max_memory : {0, 1 << 20}) {
+      VerdictCache cache;
+      ostringstream out;
+      JudgeBatch(
+          entries, test_sets,
+          [](size_t, const vector<vector<string>>& lines) {
+            return ParseCaseOutputTest(lines);
+          },
+          [](size_t, const int& n, const string& m, const string& o) {
+            return JudgeCaseStringTest(n, m, o);
+          },
+          &cache, threads, max_memory, JudgeBudgets(), out);
+      istringstream in(out.str());
+      vector<string> lines;
+      for (string line; getline(in, line);) lines.push_back(line);
+      sort(lines.begin(), lines.end());
+      assert(Eq(lines, expected));
+    }
+  }
+  VerdictCache cache;
+  ostringstream out;
+  JudgeBudgets budgets;
+  budgets.run_ns = 1000000;
+  budgets.case_ns = 1000000000;
+  JudgeBatch(
+      vector<BatchEntry>(1, entries[0]),
+      vector<const LoadedTestSet<int, string>*>(1, &test_set),
+      [](size_t, const vector<vector<string>>& lines) {
+        return ParseCaseOutputTest(lines);
+      },
+      [](size_t, const int& n, const string& m, const string& o) {
+        SpinCpu(1000000);
+        return JudgeCaseStringTest(n, m, o);
+      },
+      &cache, 1, 0, budgets, out);
+  assert(out.str() == name(0) + "\tJUDGE_TIME_LIMIT\n");
+  assert(case_cpu_budget_ns == 0);
+  for (size_t i = 0; i < contents.size(); ++i) remove(name(i).c_str());
+}
+
+// Splits the command line into --name or --name=value flags and positional
+// arguments.
+struct CommandLine {
+  map<string, string> flags;
+  vector<string> args;
+
+  bool Has(const string& name) const { return flags.count(name) > 0; }
+  string Get(const string& name, const string& default_value) const {
+    auto it = flags.find(name);
+    return it == flags.end() ? default_value : it->second;
+  }
+};
+
+CommandLine ParseCommandLine(int argc, const char* argv[]) {
+  CommandLine cl;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+      const size_t eq = arg.find('=');
+      if (eq == string::npos)
+        cl.flags[arg.substr(2)] = "";
+      else
+        cl.flags[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    } else {
+      cl.args.push_back(arg);
+    }
+  }
+  return cl;
+}
+
+// The CPU budget given in milliseconds by --flag, in nanoseconds. Raises an
+// error if it is negative or does not fit in nanoseconds.
+int64_t ParseBudgetMs(const CommandLine& cl, const string& flag) {
+  const long long ms = ParseInt(cl.Get(flag, "0"));
+  if (Failed()) return 0;
+  if (ms < 0 || ms > LLONG_MAX / 1000000) {
+    Error("Invalid --" + flag + ": " + cl.Get(flag, "0"));
+    return 0;
+  }
+  return ms * 1000000;
+}
+
+// CPU budgets from --deadline-ms and --case-deadline-ms.
+JudgeBudgets ParseJudgeBudgets(const CommandLine& cl) {
+  JudgeBudgets budgets;
+  budgets.run_ns = ParseBudgetMs(cl, "deadline-ms");
+  if (Failed()) return budgets;
+  budgets.case_ns = ParseBudgetMs(cl, "case-deadline-ms");
+  return budgets;
+}
+
+void TestParseCommandLine() {
+  const char* argv[] = {"judge", "--a", "in", "-2", "--b=x=y", "--c=", "--"};
+  const CommandLine cl = ParseCommandLine(7, argv);
+  assert(Eq(cl.args, {"in", "-2", "--"}));
+  assert(cl.Has("a") && cl.Get("a", "d") == "");
+  assert(cl.Get("b", "d") == "x=y");
+  assert(cl.Has("c") && cl.Get("c", "d") == "");
+  assert(!cl.Has("x") && cl.Get("x", "d") == "d");
+  const char* deadline_argv[] = {"judge", "--deadline-ms=5"};
+  const JudgeBudgets budgets =
+      ParseJudgeBudgets(ParseCommandLine(2, deadline_argv));
+  assert(budgets.run_ns == 5000000 && budgets.case_ns == 0);
+  const char* max_argv[] = {"judge", "--deadline-ms=0",
+                            "--case-deadline-ms=9223372036854"};
+  const JudgeBudgets max_budgets =
+      ParseJudgeBudgets(ParseCommandLine(3, max_argv));
+  assert(max_budgets.run_ns == 0 &&
+         max_budgets.case_ns == 9223372036854000000);
+  const char* negative_argv[] = {"judge", "--deadline-ms=-1"};
+  AssertError(ParseJudgeBudgets(ParseCommandLine(2, negative_argv)),
+              "Invalid --deadline-ms: -1");
+  const char* huge_argv[] = {"judge", "--case-deadline-ms=9223372036855"};
+  AssertError(ParseJudgeBudgets(ParseCommandLine(2, huge_argv)),
+              "Invalid --case-deadline-ms: 9223372036855");
+}
+
+// Sharded judging: the attempt file is split into byte ranges that start at
+// case header lines, and each range is judged by a worker process that talks
+// to the coordinator over a Unix domain socket. A worker receives the attempt
+// file name, a byte range and the index of the range's first case, and
+// replies with the outcome of splitting, parsing and judging that range. The
+// coordinator reports the error of the lowest failing stage in the lowest
+// range, which is what a single process would report first. A judge time
+// limit counts as an error of the stage it hit, so it is reported only when
+// it is that first failure.
+
+struct ShardRange {
+  size_t begin;
+  size_t end;
+  size_t first_case;
+};
+
+// Splits a file of the given size into at most num_shards ranges of similar
+// size. Every range but the first starts at one of the case headers.
+vector<ShardRange> ChooseShardRanges(const vector<size_t>& headers,
+                                     size_t size, int num_shards) {
+  vector<ShardRange> r = {{0, size, 0}};
+  for (int j = 1; j < num_shards; ++j) {
+    const size_t target = size / num_shards * j;
+    const size_t k =
+        lower_bound(headers.begin(), headers.end(), target) - headers.begin();
+    if (k == headers.size() || headers[k] <= r.back().begin) continue;
+    r.back().end = headers[k];
+    r.push_back({headers[k], size, k});
+  }
+  return r;
+}
+
+void TestChooseShardRanges() {
+  auto ranges = ChooseShardRanges({0, 10, 20, 30}, 40, 4);
+  assert(ranges.size() == 4);
+  assert(ranges[1].begin == 10 && ranges[1].end == 20 &&
+         ranges[1].first_case == 1);
+  assert(ranges[3].begin == 30 && ranges[3].end == 40 &&
+         ranges[3].first_case == 3);
+  ranges = ChooseShardRanges({0, 35}, 40, 4);
+  assert(ranges.size() == 2 && ranges[0].end == 35 && ranges[1].first_case == 1);
+  ranges = ChooseShardRanges({5}, 40, 3);
+  assert(ranges.size() == 1 && ranges[0].end == 40);
+  assert(ChooseShardRanges({}, 0, 2).size() == 1);
+}
+
+// Length-prefixed messages over a socket. Writing to a socket whose peer is
+// gone fails instead of raising SIGPIPE.
+bool WriteMessage(int fd, const string& message) {
+  BinaryWriter header;
+  header.Write<uint64_t>(message.size());
+  const string frame = header.buffer() + message;
+  for (size_t done = 0; done < frame.size();) {
+    const ssize_t n =
+        send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+bool ReadFully(int fd, char* data, size_t size) {
+  for (size_t done = 0; done < size;) {
+    const ssize_t n = read(fd, data + done, size - done);
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+bool ReadMessage(int fd, string* message) {
+  uint64_t size;
+  if (!ReadFully(fd, reinterpret_cast<char*>(&size), sizeof(size))) return false;
+  message->resize(size);
+  return ReadFully(fd, &(*message)[0], size);
+}
+
+// Outcome of judging one shard, in the order in which a single process
+// would report errors. The error of a stage may be kJudgeTimeLimitError.
+enum ShardStatus : uint8_t {
+  kShardSplitError = 0,
+  kShardParseError = 1,
+  kShardJudged = 2,
+  kShardJudgeError = 3,
+};
+
+struct ShardResult {
+  uint8_t status = kShardJudged;
+  uint64_t num_cases = 0;
+  string verdict;  // Error message, or verdict of the first failing case.
+};
+
+string EncodeShardResult(const ShardResult& r) {
+  BinaryWriter out;
+  out.Write(r.status);
+  out.Write(r.num_cases);
+  out.Write<uint64_t>(r.verdict.size());
+  return out.buffer() + r.verdict;
+}
+
+bool DecodeShardResult(const string& message, ShardResult* r) {
+  BinaryReader in(message);
+  uint64_t verdict_size;
+  vector<char> verdict;
+  if (!in.Read(&r->status) || !in.Read(&r->num_cases) ||
+      !in.Read(&verdict_size) || !in.ReadArray(verdict_size, &verdict) ||
+      !in.AtEnd())
+    return false;
+  r->verdict.assign(verdict.begin(), verdict.end());
+  return true;
+}
+
+// Splits, parses and judges the cases in one range of an attempt file.
+template <typename Inputs, typename Outputs, typename ParseCaseOutputF,
+          typename JudgeCaseF>
+ShardResult JudgeShard(const Inputs& input, const Outputs& correct_output,
+                       string_view attempt, const ShardRange& range,
+                       ParseCaseOutputF ParseCaseOutput, JudgeCaseF JudgeCase) {
+  ShardResult r;
+  TokenTable cases;
+  if (!CatchError(
+          [&] {
+            cases = TokenizeCases(
+                attempt.substr(range.begin, range.end - range.begin),
+                range.first_case + 1);
+          },
+          &r.verdict)) {
+    r.status = kShardSplitError;
+    return r;
+  }
+  r.num_cases = cases.num_cases();
+  vector<ParsedCaseOutput<ParseCaseOutputF>> parsed(cases.num_cases());
+  if (!CatchError(
+          [&] {
+            for (size_t i = 0; i < cases.num_cases() && !Failed(); ++i)
+              parsed[i] = ParseTokenCase(ParseCaseOutput, TokenCase(cases, i));
+          },
+          &r.verdict)) {
+    r.status = kShardParseError;
+    return r;
+  }
+  size_t next_case = range.first_case;
+  if (!CatchError(
+          [&] {
+            JudgeCasesFrom(
+                min(input.size(), range.first_case + cases.num_cases()),
+                [&](size_t i) {
+                  return JudgeCase(input[i], correct_output[i],
+                                   parsed[i - range.first_case]);
+                },
+                [] { return false; }, &next_case, &r.verdict);
+          },
+          &r.verdict))
+    r.status = kShardJudgeError;
+  return r;
+}
+
+// Serves shard requests on fd until the coordinator closes it. Returns false
+// if a request is malformed or a reply cannot be written.
+template <typename Inputs, typename Outputs, typename ParseCaseOutputF,
+          typename JudgeCaseF>
+bool RunShardWorker(int fd, const Inputs& input, const Outputs& correct_output,
+                    ParseCaseOutputF ParseCaseOutput, JudgeCaseF JudgeCase) {
+  for (string request; ReadMessage(fd, &request);) {
+    BinaryReader in(request);
+    ShardRange range;
+    uint64_t name_size;
+    vector<char> name;
+    if (!in.Read(&range) || !in.Read(&name_size) ||
+        !in.ReadArray(name_size, &name))
+      return false;
+    MappedFile attempt(string(name.begin(), name.end()));
+    const ShardResult r = JudgeShard(input, correct_output, attempt.view(),
+                                     range, ParseCaseOutput, JudgeCase);
+    if (!WriteMessage(fd, EncodeShardResult(r))) return false;
+  }
+  return true;
+}
+
+// Raises the error of the first failing stage of the shards, in shard order
+// within a stage, and returns the first rejected case's verdict otherwise, as
+// a single process judging all of them would. Raises a judge time limit only
+// if it is that first error.
+string MergeShardResults(const vector<ShardResult>& results,
+                         size_t num_input_cases) {
+  auto raise = [](const ShardResult& r) {
+    if (r.verdict == kJudgeTimeLimitError) {
+      JudgeTimeLimitExceeded();
+    } else {
+      Error(r.verdict);
+    }
+    return "";
+  };
+  for (uint8_t status : {kShardSplitError, kShardParseError}) {
+    for (const ShardResult& r : results) {
+      if (r.status == status) return raise(r);
+    }
+  }
+  size_t num_cases = 0;
+  for (const ShardResult& r : results) num_cases += r.num_cases;
+  CheckNumberOfCases(num_cases, num_input_cases);
+  if (Failed()) return "";
+  for (const ShardResult& r : results) {
+    if (r.status == kShardJudgeError) return raise(r);
+    if (!r.verdict.empty()) return r.verdict;
+  }
+  return "";
+}
+
+// Like JudgeAllCases on ParseAllOutput(attempt_file), with the attempt split
+// across up to num_shards local worker processes. Raises the same errors and
+// returns the same verdict as a single process would. The workers share the
+// CPU time left before the caller's deadline, and are charged to it.
+template <typename Inputs, typename Outputs, typename ParseCaseOutputF,
+          typename JudgeCaseF>
+string JudgeAllCasesSharded(const Inputs& input, const Outputs& correct_output,
+                            const string& attempt_file,
+                            ParseCaseOutputF ParseCaseOutput,
+                            JudgeCaseF JudgeCase, int num_shards) {
+  MappedFile attempt(attempt_file);
+  CheckOutputText(attempt.view());
+  if (Failed()) return "";
+  const vector<ShardRange> ranges = ChooseShardRanges(
+      FindCaseHeaders(attempt.view()), attempt.size(), max(num_shards, 1));
+  vector<pair<pid_t, int>> workers;
+  CpuPool pool;
+  for (const ShardRange& range : ranges) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      Error("Cannot create shard socket");
+      break;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      Error("Cannot start shard worker");
+      break;
+    }
+    if (pid == 0) {
+      // Only the coordinator may hold the other ends, or workers never see
+      // their socket closed.
+      close(fds[0]);
+      for (const auto& worker : workers) close(worker.second);
+      bool served;
+      {
+        CpuPool::Helper helper(pool);
+        served = RunShardWorker(fds[1], input, correct_output,
+                                ParseCaseOutput, JudgeCase);
+      }
+      _exit(served ? 0 : 1);
+    }
+    close(fds[1]);
+    workers.emplace_back(pid, fds[0]);
+    BinaryWriter request;
+    request.Write(range);
+    request.Write<uint64_t>(attempt_file.size());
+    if (!WriteMessage(fds[0], request.buffer() + attempt_file)) {
+      Error("Shard worker failed");
+      break;
+    }
+  }
+  // A worker that dies, or replies with anything but a whole result, fails
+  // the attempt as a worker failure rather than with an error of its own.
+  vector<ShardResult> results(workers.size());
+  bool ok = true;
+  for (size_t j = 0; j < workers.size(); ++j) {
+    string reply;
+    ok = ReadMessage(workers[j].second, &reply) &&
+         DecodeShardResult(reply, &results[j]) && ok;
+    close(workers[j].second);
+    int status;
+    ok = waitpid(workers[j].first, &status, 0) == workers[j].first &&
+         WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+  }
+  if (Failed()) return "";
+  if (!ok) {
+    Error("Shard worker failed");
+    return "";
+  }
+  return MergeShardResults(results, input.size());
+}
+
+void TestMergeShardResults() {
+  auto result = [](uint8_t status, uint64_t num_cases, const string& verdict) {
+    ShardResult r;
+    r.status = status;
+    r.num_cases = num_cases;
+    r.verdict = verdict;
+    return r;
+  };
+  const ShardResult judged = result(kShardJudged, 2, "");
+  const ShardResult time_limit = result(kShardSplitError, 0,
+                                        kJudgeTimeLimitError);
+  // A time limit in a later shard does not hide an earlier shard's error of
+  // the same or an earlier stage, and wins over those of later stages.
+  AssertError(MergeShardResults({judged, result(kShardSplitError, 0, "split"),
+                                 time_limit},
+                                4),
+              "split");
+  AssertError(MergeShardResults({result(kShardParseError, 1, "parse"),
+                                 time_limit},
+                                4),
+              kJudgeTimeLimitError);
+  AssertError(MergeShardResults({result(kShardJudgeError, 2, "judge"),
+                                 result(kShardJudgeError, 2,
+                                        kJudgeTimeLimitError)},
+                                4),
+              "judge");
+  AssertError(MergeShardResults({judged, judged}, 3),
+              "Wrong number of cases in attempt: 4, expected: 3");
+  assert(MergeShardResults({judged, result(kShardJudged, 2, "Case #3: x"),
+                            result(kShardJudged, 2, "Case #5: y")},
+                           6) == "Case #3: x");
+  assert(MergeShardResults({judged, judged}, 4) == "");
+}
+
+void TestJudgeAllCasesSharded() {
+  const string filename = "/tmp/judge_shard_test_" + Strint(getpid());
+  const vector<int> input = {1, 2, 3, 4, 5};
+  const vector<string> correct_output = {"a", "b", "c", "d", "e"};
+  const vector<string> attempts = {
+      "Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\nCase #5: e\n",
+      "Case #1: a\nCase #2: x\nCase #3: c\nCase #4: y\nCase #5: e",
+      "Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\ncase #5: e f\n",
+      "Case #1: a\nCase #2: b c\nCase #3: c\nCase #5: d\ncase #5: e\n",
+      "Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\n",
+      "Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\nCase #5: e\n"
+      "Case #6: f\n",
+      "x\nCase #1: a\nCase #2: b\nCase #3: c\nCase #4: d\nCase #5: e\n",
+      "Case #1: a\nCase #2: b\nCase #3:c\nCase #4: d\nCase #5: e\n",
+      "\n\nCase #1: a\nb\nCase #2: b\nCase #3: c\nCase #4: d\nCase #5: e\n",
+      "x\nCase #1: a\nCase #2: b\nCase #3: c\x01\nCase #4: d\nCase #5: e\n",
+      ""};
+  for (const string& attempt : attempts) {
+    ofstream(filename) << attempt;
+    string expected_error, expected;
+    const bool expected_ok = CatchError(
+        [&] {
+          expected = JudgeAllCases(
+              input, correct_output,
+              ParseAllOutput(filename, ParseCaseOutputTest),
+              JudgeCaseStringTest);
+        },
+        &expected_error);
+    for (int shards = 1; shards <= 6; ++shards) {
+      string error, verdict;
+      const bool ok = CatchError(
+          [&] {
+            verdict = JudgeAllCasesSharded(input, correct_output, filename,
+                                           ParseCaseOutputTest,
+                                           JudgeCaseStringTest, shards);
+          },
+          &error);
+      assert(ok == expected_ok);
+      assert(Eq(error, expected_error));
+      assert(Eq(verdict, expected));
+    }
+  }
+  // Five cases of 20ms each exceed a deadline of 50ms however they are
+  // sharded.
+  ofstream(filename) << attempts[0];
+  for (int shards = 1; shards <= 5; ++shards) {
+    ScopedDeadline deadline(50000000);
+    AssertError(JudgeAllCasesSharded(
+                    input, correct_output, filename, ParseCaseOutputTest,
+                    [](int input, const string& correct_output,
+                       const string& attempt) {
+                      SpinCpu(20000000);
+                      return JudgeCaseStringTest(input, correct_output,
+                                                 attempt);
+                    },
+                    shards),
+                kJudgeTimeLimitError);
+  }
+  remove(filename.c_str());
+}
+
+// Case indexes: the offsets of the case headers of an output file, saved in
+// the user's private CaseIndexDir() under the identity of the file, so that
+// judging a few cases of a huge file reads only those cases, and the
+// directories of the attempt and the test data are never written to. Hashing
+// the contents would cost as much as finding the headers again, so an index is
+// keyed, like make's targets, on the file's device, inode, size and
+// modification and change times, and is rebuilt when any of them changes.
+// ParseSelectedOutput also checks that each case it reads starts and ends at
+// a header with none inside, and rebuilds an index that disagrees.
+const char kCaseIndexMagic[8] = {'C', 'J', 'C', 'A', 'S', 'E', 'I', 'X'};
+const uint32_t kCaseIndexFormatVersion = 3;
+
+struct CaseIndexKey {
+  uint64_t device;
+  uint64_t inode;
+  uint64_t file_size;
+  int64_t mtime_ns;
+  int64_t ctime_ns;
+};
+
+struct CaseIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  CaseIndexKey key;
+  uint64_t num_cases;
+};
+
+// The key of filename, if it is a regular file of the given size.
+bool CaseIndexKeyOf(const string& filename, size_t size, CaseIndexKey* key) {
+  struct stat st;
+  if (filename == "-" || stat(filename.c_str(), &st) != 0 ||
+      !S_ISREG(st.st_mode) || (uint64_t)st.st_size != size)
+    return false;
+  key->device = st.st_dev;
+  key->inode = st.st_ino;
+  key->file_size = st.st_size;
+  key->mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  key->ctime_ns = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+  return true;
+}
+
+bool operator==(const CaseIndexKey& a, const CaseIndexKey& b) {
+  return a.device == b.device && a.inode == b.inode &&
+         a.file_size == b.file_size && a.mtime_ns == b.mtime_ns &&
+         a.ctime_ns == b.ctime_ns;
+}
+
+// The current user's case index directory, created if needed, or "" if there
+// is no directory that only this user can access: $XDG_CACHE_HOME/cj-caseidx,
+// ~/.cache/cj-caseidx, or else /tmp/cj-caseidx-UID.
+string CaseIndexDir() {
+  const char* xdg_cache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  string cache;
+  if (xdg_cache != nullptr && xdg_cache[0] == '/') {
+    cache = xdg_cache;
+  } else if (home != nullptr && home[0] == '/') {
+    cache = string(home) + "/.cache";
+  }
+  if (!cache.empty()) {
+    mkdir(cache.c_str(), 0700);
+    if (MakePrivateDir(cache + "/cj-caseidx")) return cache + "/cj-caseidx";
+  }
+  const string dir = "/tmp/cj-caseidx-" + Strint(geteuid());
+  return MakePrivateDir(dir) ? dir : "";
+}
+
+string CaseIndexFile(const string& dir, const CaseIndexKey& key) {
+  char name[64];
+  snprintf(name, sizeof(name), "/%016llx",
+           (unsigned long long)HashBytes(reinterpret_cast<const char*>(&key),
+                                         sizeof(key)));
+  return dir + name;
+}
+
+string BuildCaseIndex(const CaseIndexKey& key, const vector<size_t>& headers) {
+  CaseIndexHeader header;
+  memcpy(header.magic, kCaseIndexMagic, sizeof(kCaseIndexMagic));
+  header.version = kCaseIndexFormatVersion;
+  header.reserved = 0;
+  header.key = key;
+  header.num_cases = headers.size();
+  BinaryWriter out;
+  out.Write(header);
+  out.WriteArray(vector<uint64_t>(headers.begin(), headers.end()));
+  return out.buffer();
+}
+
+// Reads the header offsets of a case index built for the file with the given
+// key. Returns false, leaving headers untouched, if the index is corrupt or
+// stale.
+bool OpenCaseIndex(string_view image, const CaseIndexKey& key,
+                   vector<size_t>* headers) {
+  BinaryReader in(image);
+  CaseIndexHeader header;
+  vector<uint64_t> offsets;
+  if (!in.Read(&header) ||
+      memcmp(header.magic, kCaseIndexMagic, sizeof(kCaseIndexMagic)) != 0 ||
+      header.version != kCaseIndexFormatVersion || !(header.key == key) ||
+      !in.ReadArray(header.num_cases, &offsets) || !in.AtEnd())
+    return false;
+  for (size_t k = 0; k < offsets.size(); ++k)
+    if (offsets[k] >= key.file_size || (k > 0 && offsets[k] <= offsets[k - 1]))
+      return false;
+  headers->assign(offsets.begin(), offsets.end());
+  return true;
+}
+
+// Whether headers, the case header lines of data by an index, put the
+// selected cases where they are: each one starts at a case header line and
+// ends at the next one, or at the end of data, with none in between.
+bool CaseIndexCovers(string_view data, const vector<size_t>& headers,
+                     const vector<size_t>& selected) {
+  auto is_header = [&](size_t line) {
+    return (line == 0 || data[line - 1] == '\n') &&
+           IsCaseHeaderLine(data, line);
+  };
+  for (size_t k : selected) {
+    if (k >= headers.size() || !is_header(headers[k])) return false;
+    const size_t end = k + 1 < headers.size() ? headers[k + 1] : data.size();
+    if (end < data.size() && !is_header(end)) return false;
+    for (size_t i = simd->find_byte(data.data(), headers[k], end, '#');
+         i < end; i = simd->find_byte(data.data(), i + 1, end, '#')) {
+      const size_t line = CaseHeaderLineOf(data, i);
+      if (line != string_view::npos && line != headers[k]) return false;
+    }
+  }
+  return true;
+}
+
+void TestCaseIndex() {
+  const CaseIndexKey key = {1, 2, 100, 3, 4};
+  const string image = BuildCaseIndex(key, {0, 11, 42});
+  vector<size_t> headers;
+  assert(OpenCaseIndex(image, key, &headers));
+  assert(Eq(headers, {0, 11, 42}));
+  for (int field = 0; field < 5; ++field) {
+    CaseIndexKey other = key;
+    reinterpret_cast<uint64_t*>(&other)[field] += 1;
+    assert(!OpenCaseIndex(image, other, &headers));
+    assert(CaseIndexFile("d", other) != CaseIndexFile("d", key));
+  }
+  assert(!OpenCaseIndex(image.substr(0, image.size() - 1), key, &headers));
+  assert(!OpenCaseIndex("", key, &headers));
+  const CaseIndexKey small = {1, 2, 40, 3, 4};
+  assert(!OpenCaseIndex(BuildCaseIndex(small, {0, 11, 42}), small, &headers));
+  assert(!OpenCaseIndex(BuildCaseIndex(key, {11, 11}), key, &headers));
+  const CaseIndexKey empty = {0, 0, 0, 0, 0};
+  assert(OpenCaseIndex(BuildCaseIndex(empty, {}), empty, &headers));
+  assert(headers.empty());
+  const string data = "Case #1: a\nCase #2: b\ncase #3: c\n";
+  assert(CaseIndexCovers(data, {0, 11, 22}, {0, 1, 2}));
+  assert(CaseIndexCovers(data, {0, 22}, {1}));
+  assert(!CaseIndexCovers(data, {0, 22}, {0}));
+  assert(!CaseIndexCovers(data, {0, 11, 22}, {3}));
+  assert(!CaseIndexCovers(data, {0, 11, 24}, {1}));
+  assert(!CaseIndexCovers(data, {0, 12, 22}, {1}));
+}
+
+// The case header offsets of the output file filename, whose contents are
+// data, from its case index. A missing or stale index is rebuilt with
+// FindCaseHeaders and saved, as is any index if rebuild is set. Files that are
+// not regular, such as stdin, get no index.
+vector<size_t> LoadCaseIndex(const string& filename, string_view data,
+                             bool rebuild = false) {
+  CaseIndexKey key;
+  string dir;
+  if (!CaseIndexKeyOf(filename, data.size(), &key) ||
+      (dir = CaseIndexDir()).empty())
+    return FindCaseHeaders(data);
+  const string index_file = CaseIndexFile(dir, key);
+  vector<size_t> headers;
+  if (!rebuild) {
+    MappedFile index(index_file);
+    if (index.ok() && OpenCaseIndex(index.view(), key, &headers))
+      return headers;
+  }
+  headers = FindCaseHeaders(data);
+  const string image = BuildCaseIndex(key, headers);
+  string tmp_file = index_file + ".XXXXXX";
+  const int fd = mkstemp(&tmp_file[0]);
+  if (fd < 0) return headers;
+  bool ok = true;
+  for (size_t done = 0; ok && done < image.size();) {
+    const ssize_t n = write(fd, image.data() + done, image.size() - done);
+    ok = n > 0;
+    done += max<ssize_t>(n, 0);
+  }
+  close(fd);
+  if (!ok || rename(tmp_file.c_str(), index_file.c_str()) != 0)
+    remove(tmp_file.c_str());
+  return headers;
+}
+
+// Zero-based indexes of the cases in a --cases list of one-based case numbers
+// and ranges, such as "57,90-100", sorted and without duplicates. Raises Error
+// if the list is malformed or names a case past num_cases.
+vector<size_t> ParseCaseSelection(const string& spec, size_t num_cases) {
+  vector<size_t> r;
+  auto is_number = [](string_view s) {
+    return !s.empty() && s.size() <= 18 &&
+           all_of(s.begin(), s.end(), [](char c) { return isdigit(c); });
+  };
+  for (size_t begin = 0; begin <= spec.size();) {
+    const size_t end = min(spec.find(',', begin), spec.size());
+    const string_view part = string_view(spec).substr(begin, end - begin);
+    const size_t dash = part.find('-');
+    const string_view first = part.substr(0, dash);
+    const string_view last =
+        dash == string_view::npos ? first : part.substr(dash + 1);
+    if (!is_number(first) || !is_number(last)) {
+      Error("Invalid case selection: " + spec);
+      return {};
+    }
+    const long long a = ParseInt(first), b = ParseInt(last);
+    if (a < 1 || a > b) {
+      Error("Invalid case selection: " + spec);
+      return {};
+    }
+    if ((unsigned long long)b > num_cases) {
+      Error("Selected case " + Strint(b) + " but there are only " +
+            Strint(num_cases) + " cases");
+      return {};
+    }
+    for (long long k = a; k <= b; ++k) r.push_back(k - 1);
+    begin = end + 1;
+  }
+  sort(r.begin(), r.end());
+  r.erase(unique(r.begin(), r.end()), r.end());
+  return r;
+}
+
+void TestParseCaseSelection() {
+  assert(Eq(ParseCaseSelection("57", 100), {56}));
+  assert(Eq(ParseCaseSelection("5,2-4,3", 5), {1, 2, 3, 4}));
+  assert(Eq(ParseCaseSelection("1-1", 1), {0}));
+  for (const string spec : {"", "1,", ",1", "0", "3-2", "a", "1-", "-1",
+                            "1-2-3", "+1", " 1", "1111111111111111111"}) {
+    AssertError(ParseCaseSelection(spec, 5), "Invalid case selection: " + spec);
+  }
+  AssertError(ParseCaseSelection("2,6", 5),
+              "Selected case 6 but there are only 5 cases");
+}
+
+// Parses the selected cases of an output file with num_cases cases, in
+// selection order, reading only their lines and headers. With
+// check_structure it also checks every case header, and then the number of
+// cases after parsing the selected ones, in the order ParseAllOutput and
+// JudgeAllCases would; otherwise only that the selected cases exist.
+template <typename ParseCaseOutputF>
+vector<ParsedCaseOutput<ParseCaseOutputF>> ParseSelectedOutput(
+    const string& filename, ParseCaseOutputF ParseCaseOutput,
+    const vector<size_t>& selected, size_t num_cases, bool check_structure) {
+  const FileContents file(filename);
+  const string_view data = file.view();
+  vector<size_t> headers = LoadCaseIndex(filename, data);
+  if (!CaseIndexCovers(data, headers, selected))
+    headers = LoadCaseIndex(filename, data, true);
+  if (check_structure) {
+    CheckOutputText(data);
+    if (Failed()) return {};
+    CheckCaseHeaders(data, headers, 1);
+  } else if (!selected.empty() && selected.back() >= headers.size()) {
+    CheckNumberOfCases(headers.size(), num_cases);
+  }
+  if (Failed()) return {};
+  TokenTable table;
+  for (size_t k : selected) {
+    // Only with check_structure, which reports the missing cases below.
+    if (k >= headers.size()) break;
+    const size_t case_end =
+        k + 1 < headers.size() ? headers[k + 1] : data.size();
+    if (!check_structure) CheckOutputText(data, headers[k], case_end);
+    if (Failed()) return {};
+    const size_t body = CheckCaseHeader(data, headers[k], k + 1);
+    if (Failed()) return {};
+    AppendCaseTokens(data, body, case_end, &table);
+    if (Failed()) return {};
+  }
+  vector<ParsedCaseOutput<ParseCaseOutputF>> v(selected.size());
+  for (size_t j = 0; j < table.num_cases(); ++j) {
+    v[j] = ParseTokenCase(ParseCaseOutput, TokenCase(table, j));
+    if (Failed()) return {};
+  }
+  if (check_structure) CheckNumberOfCases(headers.size(), num_cases);
+  if (Failed()) return {};
+  return v;
+}
+
+// Like JudgeAllCases, for the selected cases only: correct_output and attempt
+// hold the selected cases in selection order.
+template <typename Inputs, typename U, typename JudgeCaseF>
+string JudgeSelectedCases(const Inputs& input, const vector<size_t>& selected,
+                          const vector<U>& correct_output,
+                          const vector<U>& attempt, JudgeCaseF JudgeCase) {
+  size_t j = 0;
+  typename decay<decltype(JudgeCase(input[0], correct_output[0],
+                                    attempt[0]))>::type verdict;
+  JudgeCasesUntilRejected(
+      selected.size(),
+      [&](size_t j) {
+        return JudgeCase(input[selected[j]], correct_output[j], attempt[j]);
+      },
+      [] { return false; }, &j, &verdict);
+  if (IsAccepted(verdict)) return "";
+  return RenderRejectedCase(selected[j], RenderCaseVerdict(verdict));
+}
+
+void TestJudgeSelectedCases() {
+  const string prefix = "/tmp/judge_selected_test_" + Strint(getpid());
+  // Indexes go to a cache directory of the test's own.
+  const char* saved_cache = getenv("XDG_CACHE_HOME");
+  const string saved_cache_dir = saved_cache == nullptr ? "" : saved_cache;
+  const string cache_dir = prefix + "_cache";
+  setenv("XDG_CACHE_HOME", cache_dir.c_str(), 1);
+  assert(CaseIndexDir() == cache_dir + "/cj-caseidx");
+  const vector<int> input = {1, 2, 3, 4, 5};
+  const vector<string> correct_output = {"a", "b", "c", "d", "e"};
+  // A new file for each attempt: rewriting one within a timestamp tick keeps
+  // its key.
+  vector<string> filenames;
+  string filename;
+  set<string> index_files;
+  auto write_attempt = [&](const string& attempt) {
+    filename = prefix + "_" + Strint(filenames.size());
+    filenames.push_back(filename);
+    ofstream(filename) << attempt;
+  };
+  auto judge_file = [&](const string& cases, bool check_structure) {
+    CaseIndexKey key;
+    if (CaseIndexKeyOf(filename, MappedFile(filename).size(), &key))
+      index_files.insert(CaseIndexFile(CaseIndexDir(), key));
+    const vector<size_t> selected = ParseCaseSelection(cases, input.size());
+    vector<string> correct;
+    for (size_t k : selected) correct.push_back(correct_output[k]);
+    const vector<string> parsed =
+        ParseSelectedOutput(filename, ParseCaseOutputTest, selected,
+                            input.size(), check_structure);
+    if (Failed()) return string();
+    return JudgeSelectedCases(input, selected, correct, parsed,
+                              JudgeCaseStringTest);
+  };
+  auto judge = [&](const string& attempt, const string& cases,
+                   bool check_structure) {
+    write_attempt(attempt);
+    return judge_file(cases, check_structure);
+  };
+  const string ok =
+      "Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\nCase #5: e";
+  assert(judge(ok, "1-5", true) == "");
+  assert(judge(ok, "2,4", false) == "");
+  const string wrong =
+      "Case #1: a\nCase #2: x\nCase #3: c\nCase #4: y\nCase #5: e";
+  assert(judge(wrong, "3-5", false) == "Case #4: y is not d");
+  assert(judge(wrong, "1,3,5", true) == "");
+  // Rewriting the file invalidates its index.
+  const string moved = "Case #1: a\n\nCase #2: b\nCase #3: c\nCase #4: y\n"
+                       "Case #5: e";
+  assert(judge(moved, "4", false) == "Case #4: y is not d");
+  const string broken = "x\nCase #1: a\nCase #2: b\nCase #3: b c\nCase #4: d\n";
+  assert(judge(broken, "2", false) == "");
+  AssertError(judge(broken, "2", true),
+              "First line doesn't start with case #1:");
+  AssertError(judge(broken, "3", false), "Bad test output");
+  AssertError(judge(broken, "5", false),
+              "Wrong number of cases in attempt: 4, expected: 5");
+  // A selected case that does not parse comes before a missing case.
+  const string short_bad = "Case #1: a b\nCase #2: b\nCase #3: c\n";
+  AssertError(judge(short_bad, "1-5", true), "Bad test output");
+  AssertError(judge(short_bad, "2", true),
+              "Wrong number of cases in attempt: 3, expected: 5");
+  const string misnumbered = "Case #1: a\nCase #3: b\nCase #3: c\nCase #4: d\n"
+                             "Case #5: e";
+  assert(judge(misnumbered, "1,3-5", false) == "");
+  AssertError(judge(misnumbered, "1,3-5", true), "Found case: 3, expected: 2");
+  AssertError(judge(misnumbered, "2", false), "Found case: 3, expected: 2");
+  const string garbage = "Case #1: a\nCase #2: \x01\nCase #3: c\nCase #4: d\n"
+                         "Case #5: e";
+  assert(judge(garbage, "1,3", false) == "");
+  AssertError(judge(garbage, "1,3", true),
+              "Invalid byte 0x01 in output on line 2");
+  // The index is saved in the cache directory, not next to the attempt.
+  CaseIndexKey key;
+  assert(CaseIndexKeyOf(filename, garbage.size(), &key));
+  assert(access(CaseIndexFile(CaseIndexDir(), key).c_str(), F_OK) == 0);
+  // Rewriting the file in place, to the same size, invalidates its index.
+  const string same_size =
+      "Case #1: a\nCase #2: b c\nCase #3: c\nCase #4: d\nCase #5:";
+  assert(same_size.size() == garbage.size());
+  ofstream(filename) << same_size;
+  const timespec later[2] = {{0, UTIME_OMIT}, {time(nullptr) + 10, 0}};
+  utimensat(AT_FDCWD, filename.c_str(), later, 0);
+  AssertError(judge_file("2", false), "Bad test output");
+  // An index that disagrees with the file is rebuilt, not trusted.
+  write_attempt(ok);
+  assert(CaseIndexKeyOf(filename, ok.size(), &key));
+  ofstream(CaseIndexFile(CaseIndexDir(), key))
+      << BuildCaseIndex(key, {0, 22, 33, 44});
+  assert(judge_file("1-5", false) == "");
+  for (const string& index_file : index_files) remove(index_file.c_str());
+  for (const string& f : filenames) remove(f.c_str());
+  rmdir((cache_dir + "/cj-caseidx").c_str());
+  rmdir(cache_dir.c_str());
+  if (saved_cache == nullptr) {
+    unsetenv("XDG_CACHE_HOME");
+  } else {
+    setenv("XDG_CACHE_HOME", saved_cache_dir.c_str(), 1);
+  }
+}
+
+// Stable C ABI for problem plugins: shared objects that hold the
+// problem-specific logic of a judge, hosted by a judge process that provides
+// tokenizing, case splitting, verdict caching and batch scheduling for every
+// problem. Changing these declarations requires bumping
+// JUDGE_PLUGIN_ABI_VERSION, which also names the plugin entry point, so that
+// a plugin built for another version fails to load at dlsym instead of being
+// read with the wrong layout.
+extern "C" {
+struct JudgePluginToken {
+  const char* data;
+  size_t size;
+};
+
+struct JudgePluginLine {
+  const JudgePluginToken* tokens;
+  size_t num_tokens;
+};
+
+// Messages are written to a buffer of *message_size bytes, which is set to
+// the length of the whole message, 0 if there is none. If that is not less
+// than the buffer size, the message was truncated and the call can be
+// repeated with a larger buffer.
+struct JudgePluginApi {
+  uint32_t abi_version;
+  const char* problem_name;
+  // Sets the CPU deadline of the calling thread, in ThreadCpuTimeNs time or 0
+  // for none, and the CPU budget of each case, for the calls that follow.
+  void (*set_deadlines)(int64_t cpu_deadline_ns, int64_t case_cpu_budget_ns);
+  // Parses a whole input file into an opaque handle holding *num_cases cases,
+  // or returns null with a message in error.
+  void* (*parse_input)(const char* data, size_t size, size_t* num_cases,
+                       char* error, size_t* error_size);
+  // Parses the lowercased token lines of one case of output, without the case
+  // header, into an opaque handle, or returns null with a message in error.
+  void* (*parse_case_output)(const JudgePluginLine* lines, size_t num_lines,
+                             char* error, size_t* error_size);
+  // Writes the verdict of one case, empty if accepted, to message and returns
+  // 1, or returns 0 with the error that judging raised in message.
+  int (*judge_case)(const void* input, size_t case_index,
+                    const void* correct_output, const void* attempt,
+                    char* message, size_t* message_size);
+  uint64_t (*estimate_case_cost)(const void* input, size_t case_index);
+  void (*free_input)(void* input);
+  void (*free_case_output)(void* output);
+};
+
+typedef const JudgePluginApi* (*JudgePluginEntryPoint)();
+}
+
+#define JUDGE_PLUGIN_ABI_VERSION 2
+#define JUDGE_CONCAT_(a, b) a##b
+#define JUDGE_CONCAT(a, b) JUDGE_CONCAT_(a, b)
+#define JUDGE_STRINGIFY_(x) #x
+#define JUDGE_STRINGIFY(x) JUDGE_STRINGIFY_(x)
+// JudgePluginApiV<version>.
+#define JUDGE_PLUGIN_ENTRY_POINT \
+  JUDGE_CONCAT(JudgePluginApiV, JUDGE_PLUGIN_ABI_VERSION)
+
+const uint32_t kJudgePluginAbiVersion = JUDGE_PLUGIN_ABI_VERSION;
+const char kJudgePluginEntryPointName[] =
+    JUDGE_STRINGIFY(JUDGE_PLUGIN_ENTRY_POINT);
+const size_t kJudgePluginMessageSize = 1024;
+
+void CopyPluginMessage(const string& message, char* buffer, size_t* size) {
+  if (*size > 0) snprintf(buffer, *size, "%s", message.c_str());
+  *size = message.size();
+}
+
+// Exposes the logic of a problem type P through the plugin ABI. A judge built
+// with -DJUDGE_PLUGIN exports Api() of its adapter as the plugin entry point.
+// Errors raised by the problem are caught and returned across the ABI as
+// messages.
+template <typename P>
+struct JudgePluginAdapter {
+  typedef typename P::Input T;
+  typedef typename P::Output U;
+
+  // The plugin has deadlines of its own, which the host sets before each call.
+  static void SetDeadlines(int64_t deadline_ns, int64_t case_budget_ns) {
+    cpu_deadline_ns = deadline_ns == 0 ? 0 : deadline_ns + helper_cpu_ns;
+    case_cpu_budget_ns = case_budget_ns;
+  }
+
+  static void* ParseInput(const char* data, size_t size, size_t* num_cases,
+                          char* error, size_t* error_size) {
+    unique_ptr<vector<T>> input(new vector<T>);
+    string e;
+    if (!CatchError(
+            [&] {
+              istringstream in(string(data, size));
+              *input = ParseAllInputFrom(in, ParseCaseInputOf<P>());
+            },
+            &e)) {
+      CopyPluginMessage(e, error, error_size);
+      return nullptr;
+    }
+    *num_cases = input->size();
+    *error_size = 0;
+    return input.release();
+  }
+
+  // Parses the case with P's TokenCase overload if it has one, from a
+  // TokenTable of the case reused across calls, or else from strings.
+  static void* ParseCaseOutput(const JudgePluginLine* lines, size_t num_lines,
+                               char* error, size_t* error_size) {
+    unique_ptr<U> output(new U);
+    string e;
+    if (!CatchError(
+            [&] {
+              if constexpr (is_invocable<ParseCaseOutputOf<P>,
+                                         const TokenCase&>::value) {
+                thread_local TokenTable table;
+                table.clear();
+                for (size_t i = 0; i < num_lines; ++i) {
+                  for (size_t j = 0; j < lines[i].num_tokens; ++j) {
+                    table.bytes.append(lines[i].tokens[j].data,
+                                       lines[i].tokens[j].size);
+                    table.token_begin.push_back(table.bytes.size());
+                  }
+                  table.line_begin.push_back(table.token_begin.size() - 1);
+                }
+                table.case_begin.push_back(num_lines);
+                *output = P::ParseCaseOutput(TokenCase(table, 0));
+              } else {
+                vector<vector<string>> case_lines(num_lines);
+                for (size_t i = 0; i < num_lines; ++i)
+                  for (size_t j = 0; j < lines[i].num_tokens; ++j)
+                    case_lines[i].emplace_back(lines[i].tokens[j].data,
+                                               lines[i].tokens[j].size);
+                *output = P::ParseCaseOutput(case_lines);
+              }
+            },
+            &e)) {
+      CopyPluginMessage(e, error, error_size);
+      return nullptr;
+    }
+    *error_size = 0;
+    return output.release();
+  }
+
+  static int JudgeCase(const void* input, size_t case_index,
+                       const void* correct_output, const void* attempt,
+                       char* message, size_t* message_size) {
+    string verdict;
+    string e;
+    if (!CatchError(
+            [&] {
+              verdict = RenderCaseVerdict(P::JudgeCase(
+                  (*static_cast<const vector<T>*>(input))[case_index],
+                  *static_cast<const U*>(correct_output),
+                  *static_cast<const U*>(attempt)));
+            },
+            &e)) {
+      CopyPluginMessage(e, message, message_size);
+      return 0;
+    }
+    CopyPluginMessage(verdict, message, message_size);
+    return 1;
+  }
+
+  static uint64_t EstimateCaseCost(const void* input, size_t case_index) {
+    return P::EstimateCaseCost(
+        (*static_cast<const vector<T>*>(input))[case_index]);
+  }
+
+  static void FreeInput(void* input) { delete static_cast<vector<T>*>(input); }
+  static void FreeCaseOutput(void* output) { delete static_cast<U*>(output); }
+
+  static const JudgePluginApi* Api(const char* problem_name) {
+    static const JudgePluginApi api = {
+        kJudgePluginAbiVersion, problem_name,   SetDeadlines,
+        ParseInput,             ParseCaseOutput, JudgeCase,
+        EstimateCaseCost,       FreeInput,      FreeCaseOutput};
+    return &api;
+  }
+};
+
+// Case input of a plugin problem: the plugin's parsed input file and the index
+// of the case in it.
+struct PluginCaseInput {
+  shared_ptr<void> cases;
+  size_t index = 0;
+};
+
+// Case output of a plugin problem, opaque to the host.
+typedef shared_ptr<void> PluginCaseOutput;
+
+// Host side of a problem plugin, raising Error for the errors it reports.
+class JudgePlugin {
+ public:
+  explicit JudgePlugin(const JudgePluginApi* api) : api_(api) {}
+
+  string problem_name() const { return api_->problem_name; }
+
+  vector<PluginCaseInput> ParseAllInput(const string& filename) const {
+    const FileContents file(filename);
+    if (!file.ok()) {
+      Error("Cannot read input file: " + filename);
+      return {};
+    }
+    size_t num_cases = 0;
+    void* cases = nullptr;
+    const string error = CallWithMessage([&](char* error, size_t* size) {
+      cases = api_->parse_input(file.view().data(), file.view().size(),
+                                &num_cases, error, size);
+    });
+    if (cases == nullptr) {
+      Error(error);
+      return {};
+    }
+    shared_ptr<void> owner(cases, api_->free_input);
+    vector<PluginCaseInput> r(num_cases);
+    for (size_t i = 0; i < num_cases; ++i) r[i] = {owner, i};
+    return r;
+  }
+
+  // Lines are vector<vector<string>> or a TokenCase, whose tokens are passed
+  // to the plugin without copies.
+  template <typename Lines>
+  PluginCaseOutput ParseCaseOutput(const Lines& lines) const {
+    size_t num_tokens = 0;
+    for (size_t j = 0; j < lines.size(); ++j) num_tokens += lines[j].size();
+    vector<JudgePluginToken> tokens;
+    tokens.reserve(num_tokens);
+    vector<JudgePluginLine> plugin_lines;
+    for (size_t j = 0; j < lines.size(); ++j) {
+      const auto& line = lines[j];
+      plugin_lines.push_back({tokens.data() + tokens.size(), line.size()});
+      for (size_t i = 0; i < line.size(); ++i) {
+        const string_view token = line[i];
+        tokens.push_back({token.data(), token.size()});
+      }
+    }
+    void* output = nullptr;
+    const string error = CallWithMessage([&](char* error, size_t* size) {
+      output = api_->parse_case_output(plugin_lines.data(),
+                                       plugin_lines.size(), error, size);
+    });
+    if (output == nullptr) {
+      Error(error);
+      return PluginCaseOutput();
+    }
+    return PluginCaseOutput(output, api_->free_case_output);
+  }
+
+  // Raises the errors that judging raised in the plugin, such as running out
+  // of CPU time.
+  string JudgeCase(const PluginCaseInput& input,
+                   const PluginCaseOutput& correct_output,
+                   const PluginCaseOutput& attempt) const {
+    int judged = 0;
+    const string message = CallWithMessage([&](char* message, size_t* size) {
+      judged = api_->judge_case(input.cases.get(), input.index,
+                                correct_output.get(), attempt.get(), message,
+                                size);
+    });
+    if (!judged) {
+      if (message == kJudgeTimeLimitError) JudgeTimeLimitExceeded();
+      Error(message);
+      return "";
+    }
+    return message;
+  }
+
+  uint64_t EstimateCaseCost(const PluginCaseInput& input) const {
+    return api_->estimate_case_cost(input.cases.get(), input.index);
+  }
+
+ private:
+  // Calls f(message, &size) with the calling thread's deadlines set in the
+  // plugin and a message buffer of size bytes, and again with a larger
+  // buffer if the message did not fit. Returns the message.
+  template <typename F>
+  string CallWithMessage(const F& f) const {
+    string message(kJudgePluginMessageSize, '\0');
+    for (;;) {
+      api_->set_deadlines(
+          cpu_deadline_ns == 0 ? 0 : cpu_deadline_ns - helper_cpu_ns,
+          case_cpu_budget_ns);
+      size_t size = message.size();
+      f(&message[0], &size);
+      if (size < message.size()) {
+        message.resize(size);
+        return message;
+      }
+      message.assign(size + 1, '\0');
+    }
+  }
+
+  const JudgePluginApi* api_;
+};
+
+// Loads the plugin at path, raising Error if it cannot be loaded or was built
+// for another ABI version. Plugins stay loaded for the life of the process.
+JudgePlugin LoadJudgePlugin(const string& path) {
+  void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    Error("Cannot load plugin: " + path);
+    return JudgePlugin(nullptr);
+  }
+  auto entry_point = reinterpret_cast<JudgePluginEntryPoint>(
+      dlsym(handle, kJudgePluginEntryPointName));
+  const JudgePluginApi* api = entry_point ? entry_point() : nullptr;
+  if (api == nullptr || api->abi_version != kJudgePluginAbiVersion) {
+    Error("Incompatible plugin: " + path);
+    return JudgePlugin(nullptr);
+  }
+  return JudgePlugin(api);
+}
+
+int ParseCaseInputTest(istream& in) {
+  int n;
+  in >> n;
+  if (n < 0) {
+    Error("Negative test input");
+    return 0;
+  }
+  return n;
+}
+
+uint64_t EstimateCaseCostTest(const int& n) { return n; }
+
+struct ProblemTest {
+  typedef int Input;
+  typedef string Output;
+  static int ParseCaseInput(istream& in) { return ParseCaseInputTest(in); }
+  static string ParseCaseOutput(const vector<vector<string>>& lines) {
+    return ParseCaseOutputTest(lines);
+  }
+  static string JudgeCase(const int& n, const string& m, const string& o) {
+    return JudgeCaseStringTest(n, m, o);
+  }
+  static uint64_t EstimateCaseCost(const int& n) {
+    return EstimateCaseCostTest(n);
+  }
+};
+
+void TestProblemTraits() {
+  const string prefix = "/tmp/judge_problem_test_" + Strint(getpid());
+  ofstream(prefix + "_in") << "2\n5\n7\n";
+  ofstream(prefix + "_out") << "Case #1: a\nCase #2: B\n";
+  ofstream(prefix + "_attempt") << "Case #1: a\nCase #2: c\n";
+  const vector<int> input = ParseAllInput<ProblemTest>(prefix + "_in");
+  assert(Eq(input, {5, 7}));
+  const vector<string> correct_output =
+      ParseAllOutput<ProblemTest>(prefix + "_out");
+  assert(Eq(correct_output, {"a", "b"}));
+  assert(JudgeAllCases<ProblemTest>(input, correct_output, correct_output) ==
+         "");
+  assert(JudgeAllCases<ProblemTest>(
+             input, correct_output,
+             ParseAllOutput<ProblemTest>(prefix + "_attempt")) ==
+         "Case #2: c is not b");
+  AssertError(ParseAllOutput<ProblemTest>(prefix + "_in"),
+              "First line doesn't start with case #1:");
+  // Attempts can also come from a pipe.
+  int fds[2];
+  assert(pipe(fds) == 0);
+  assert(write(fds[1], "Case #1: A\ncase #2: b\n", 22) == 22);
+  close(fds[1]);
+  assert(Eq(ParseAllOutput(fds[0], ParseCaseOutputOf<ProblemTest>()),
+            {"a", "b"}));
+  close(fds[0]);
+  for (const char* suffix : {"_in", "_out", "_attempt"})
+    remove((prefix + suffix).c_str());
+}
+
+const VerdictKind kTooLongTest = {"TOO_LONG", "Too long"};
+
+// Scores each case by the length of the attempt, which must not be longer
+// than the input.
+struct ScoringProblemTest : ProblemTest {
+  static CaseScore ScoreCase(const int& n, const string& m, const string& o) {
+    CaseScore r;
+    if ((int)o.size() > n) {
+      r.verdict = Reject(kTooLongTest, n, o.size());
+    } else {
+      r.score = o.size() + 1.0 / (m.size() + n);
+    }
+    return r;
+  }
+};
+
+void TestScoreAttempt() {
+  const string filename = "/tmp/judge_score_test_" + Strint(getpid());
+  const size_t num_cases = 2 * kScoreBlockCases + 3;
+  vector<int> input(num_cases);
+  vector<string> correct_output(num_cases);
+  string attempt;
+  for (size_t i = 0; i < num_cases; ++i) {
+    input[i] = i % 7;
+    correct_output[i] = string(i % 5 + 1, 'a');
+    attempt += "Case #" + Strint(i + 1) + ": " + string(i % 6 + 1, 'B') + "\n";
+  }
+  ofstream(filename) << attempt;
+  const AttemptScore score =
+      ScoreAttempt<ScoringProblemTest>(input, correct_output, filename);
+  // Case 1 has an input of 0 and an attempt of length 1.
+  assert(!score.verdict.verdict.accepted() && score.verdict.case_index == 0);
+  assert(RenderAttemptVerdict(score.verdict) == "Case #1: Too long");
+  assert(score.case_scores.size() == num_cases);
+  for (size_t i = 0; i < num_cases; ++i) {
+    const CaseScore s = ScoringProblemTest::ScoreCase(
+        input[i], correct_output[i], string(i % 6 + 1, 'b'));
+    assert(score.case_scores[i] == s.score);
+  }
+  assert(score.total == DeterministicSum(score.case_scores));
+  for (int threads = 2; threads <= 4; ++threads) {
+    const AttemptScore s = ScoreAttempt<ScoringProblemTest>(
+        input, correct_output, filename, threads);
+    assert(s.case_scores == score.case_scores && s.total == score.total);
+    assert(s.verdict.case_index == 0);
+  }
+  // Errors are the ones ParseAllOutput and JudgeAllCases raise.
+  const vector<pair<string, string>> bad = {
+      {"Case #1: a\n", "Wrong number of cases in attempt: 1, expected: 3"},
+      {"Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\n",
+       "Wrong number of cases in attempt: 4, expected: 3"},
+      {"Case #1: a\nCase #2: b c\nCase #3: c\nCase #4: d\n",
+       "Bad test output"},
+      {"Case #1: a b\nCase #2: b\nCase #4: c\n",
+       "Found case: 4, expected: 3"},
+      {"Case #1: a b\nCase #2: b\nCase #3: \x80\n",
+       "Invalid byte 0x80 in output on line 3"},
+      {"Case #1: a\nCase #2:\nCase #3: c\n", "Bad test output"},
+      {"x\nCase #1: a\n", "First line doesn't start with case #1:"},
+  };
+  for (const auto& b : bad) {
+    ofstream(filename) << b.first;
+    AssertError(
+        CheckNumberOfCases(ParseAllOutput<ProblemTest>(filename).size(), 3),
+        b.second);
+    for (int threads = 1; threads <= 3; ++threads) {
+      AssertError(ScoreAttempt<ScoringProblemTest>({1, 1, 1}, {"a", "b", "c"},
+                                                   filename, threads),
+                  b.second);
+    }
+  }
+  // Errors scoring a case come after those of parsing and counting cases.
+  auto failing_score = [](const int&, const string&, const string&) {
+    Error("Cannot score");
+    return CaseScore();
+  };
+  for (const auto& b : bad) {
+    ofstream(filename) << b.first;
+    AssertError(ScoreAttempt(vector<int>{1, 1, 1},
+                             vector<string>{"a", "b", "c"}, filename,
+                             ParseCaseOutputTest, failing_score, 2),
+                b.second);
+  }
+  ofstream(filename) << "Case #1: a\nCase #2: b\nCase #3: c\n";
+  AssertError(ScoreAttempt(vector<int>{1, 1, 1}, vector<string>{"a", "b", "c"},
+                           filename, ParseCaseOutputTest, failing_score, 2),
+              "Cannot score");
+  const AttemptScore accepted = ScoreAttempt<ScoringProblemTest>(
+      {1, 2, 3}, {"a", "b", "c"}, filename, 2);
+  assert(accepted.verdict.verdict.accepted());
+  assert(accepted.total == (1 + 1.0 / 2) + (1 + 1.0 / 3) + (1 + 1.0 / 4));
+  // Eight cases of 5ms each exceed a deadline of 20ms on four threads too.
+  ofstream(filename) << "Case #1: a\nCase #2: a\nCase #3: a\nCase #4: a\n"
+                        "Case #5: a\nCase #6: a\nCase #7: a\nCase #8: a\n";
+  auto slow_score = [](const int& input, const string& correct_output,
+                       const string& attempt) {
+    SpinCpu(5000000);
+    return ScoringProblemTest::ScoreCase(input, correct_output, attempt);
+  };
+  {
+    ScopedDeadline deadline(20000000);
+    AssertError(ScoreAttempt(vector<int>(8, 1), vector<string>(8, "a"),
+                             filename, ParseCaseOutputTest, slow_score, 4),
+                kJudgeTimeLimitError);
+  }
+  remove(filename.c_str());
+}
+
+void TestJudgeAllCasesOnline() {
+  const string filename = "/tmp/judge_online_test_" + Strint(getpid());
+  const vector<int> input = {1, 2, 3};
+  const vector<string> correct_output = {"a", "b", "c"};
+  auto judge_file = [&](const string& attempt) {
+    ofstream(filename) << attempt;
+    CaseReader reader(filename, 5);
+    return JudgeAllCasesOnline(input, correct_output, &reader,
+                               ParseCaseOutputTest, JudgeCaseStringTest);
+  };
+  // The same verdicts and errors as judging the whole file.
+  for (const string attempt :
+       {"Case #1: a\nCase #2: B\nCase #3: c\n", "Case #1: a\ncase #2: b\n",
+        "Case #1: a\nCase #2: b\nCase #3: c\nCase #4: d\n",
+        "Case #1: a\nCase #2: x\nCase #3: c\n", "Case #1: a b\nCase #2: x",
+        "Case #1: a\nCase #3: b\n", "Case #1: a\n\xff"}) {
+    string expected, expected_error, error;
+    const bool expected_ok = CatchError(
+        [&] {
+          ofstream(filename) << attempt;
+          const vector<string> attempt_output =
+              ParseAllOutput(filename, ParseCaseOutputTest);
+          expected = JudgeAllCases(input, correct_output, attempt_output,
+                                   JudgeCaseStringTest);
+        },
+        &expected_error);
+    string verdict;
+    assert(CatchError([&] { verdict = judge_file(attempt); }, &error) ==
+           expected_ok);
+    assert(verdict == expected && error == expected_error);
+  }
+  // Unlike judging the whole file, a rejected case comes first.
+  assert(judge_file("Case #1: x\nCase #2: b b\n") == "Case #1: x is not a");
+  assert(judge_file("Case #1: x\n") == "Case #1: x is not a");
+  // A rejected case is reported while the attempt is still being written.
+  int fds[2];
+  assert(pipe(fds) == 0);
+  atomic<bool> judged(false);
+  thread writer([&] {
+    const string text = "Case #1: a\nCase #2: x\nCase #3: c\n";
+    assert(write(fds[1], text.data(), text.size()) == (ssize_t)text.size());
+    while (!judged) usleep(1000);
+    close(fds[1]);
+  });
+  {
+    CaseReader reader(fds[0]);
+    assert(JudgeAllCasesOnline(input, correct_output, &reader,
+                               ParseCaseOutputTest,
+                               JudgeCaseStringTest) == "Case #2: x is not b");
+  }
+  judged = true;
+  writer.join();
+  // A file that grows while it is judged.
+  ofstream(filename) << "";
+  atomic<bool> writing(true);
+  thread appender([&] {
+    for (const char* part : {"Case #1: a\nCa", "se #2: b\n", "Case #3: c"}) {
+      usleep(5000);
+      ofstream(filename, ios::app) << part;
+    }
+    writing = false;
+  });
+  CaseReader reader(filename, 4);
+  reader.Follow([&] { return writing.load(); });
+  assert(JudgeAllCasesOnline(input, correct_output, &reader,
+                             ParseCaseOutputTest, JudgeCaseStringTest) == "");
+  appender.join();
+  assert(reader.num_cases() == 3);
+  assert(ProcessRunning(getpid()));
+  // A writer that exited is not running, even before it is waited for.
+  const pid_t exited = fork();
+  if (exited == 0) _exit(0);
+  for (int i = 0; i < 1000 && ProcessRunning(exited); ++i) usleep(1000);
+  assert(!ProcessRunning(exited));
+  waitpid(exited, nullptr, 0);
+  assert(!ProcessRunning(exited));
+  remove(filename.c_str());
+}
+
+// Judges input 0 with a verdict longer than a plugin message buffer, raises
+// an error for input 1 and checks the deadline for the others.
+struct PluginProblemTest : ProblemTest {
+  static string JudgeCase(const int& n, const string&, const string&) {
+    if (n == 0) return string(3 * kJudgePluginMessageSize, 'x');
+    if (n == 1) Error("Cannot judge");
+    CheckDeadline();
+    return "";
+  }
+};
+
+void TestJudgePlugin() {
+  const JudgePlugin plugin(JudgePluginAdapter<ProblemTest>::Api("t"));
+  assert(plugin.problem_name() == "t");
+  const string prefix = "/tmp/judge_plugin_test_" + Strint(getpid());
+  ofstream(prefix + "_in") << "2\n5\n7\n";
+  ofstream(prefix + "_bad_in") << "1 -1";
+  ofstream(prefix + "_out") << "Case #1: a\nCase #2: B\n";
+  ofstream(prefix + "_attempt") << "Case #1: a\nCase #2: c\n";
+  const vector<PluginCaseInput> input = plugin.ParseAllInput(prefix + "_in");
+  assert(input.size() == 2 && input[1].index == 1);
+  assert(plugin.EstimateCaseCost(input[1]) == 7);
+  auto parse = [&](const vector<vector<string>>& lines) {
+    return plugin.ParseCaseOutput(lines);
+  };
+  auto judge = [&](const PluginCaseInput& i, const PluginCaseOutput& c,
+                   const PluginCaseOutput& a) {
+    return plugin.JudgeCase(i, c, a);
+  };
+  const auto correct_output = ParseAllOutput(prefix + "_out", parse);
+  assert(JudgeAllCases(input, correct_output, correct_output, judge) == "");
+  assert(JudgeAllCases(input, correct_output,
+                       ParseAllOutput(prefix + "_attempt", parse),
+                       judge) == "Case #2: c is not b");
+  AssertError(plugin.ParseCaseOutput(vector<vector<string>>{{"a", "b"}}),
+              "Bad test output");
+  AssertError(plugin.ParseAllInput(prefix + "_bad_in"), "Negative test input");
+  AssertError(plugin.ParseAllInput(prefix + "_missing"),
+              "Cannot read input file: " + prefix + "_missing");
+  assert(string(kJudgePluginEntryPointName) == "JudgePluginApiV2");
+  const JudgePlugin judging(JudgePluginAdapter<PluginProblemTest>::Api("j"));
+  ofstream(prefix + "_in") << "3\n0\n1\n2\n";
+  const vector<PluginCaseInput> cases = judging.ParseAllInput(prefix + "_in");
+  const PluginCaseOutput output =
+      judging.ParseCaseOutput(vector<vector<string>>{{"a"}});
+  assert(judging.JudgeCase(cases[0], output, output) ==
+         string(3 * kJudgePluginMessageSize, 'x'));
+  AssertError(judging.JudgeCase(cases[1], output, output), "Cannot judge");
+  assert(judging.JudgeCase(cases[2], output, output) == "");
+  {
+    ScopedDeadline deadline(1);
+    SpinCpu(1000);
+    AssertError(judging.JudgeCase(cases[2], output, output),
+                kJudgeTimeLimitError);
+  }
+  AssertError(LoadJudgePlugin(prefix + "_missing.so"),
+              "Cannot load plugin: " + prefix + "_missing.so");
+  for (const char* suffix : {"_in", "_bad_in", "_out", "_attempt"})
+    remove((prefix + suffix).c_str());
+}
+
+// Judges with problem plugins instead of the logic compiled into this judge,
+// for --plugin=PLUGIN: the single attempt and -batch modes of main, where
+// batch lines may name their own plugin. Precompiled and shared test sets are
+// not available to plugins.
+int RunPluginHost(const CommandLine& cl) {
+  const vector<string>& args = cl.args;
+  map<string, JudgePlugin> plugins;
+  auto plugin_for = [&](const string& path) -> const JudgePlugin* {
+    auto it = plugins.find(path);
+    if (it == plugins.end())
+      it = plugins.emplace(path, LoadJudgePlugin(path)).first;
+    return &it->second;
+  };
+  auto key_seed_for = [](const JudgePlugin& plugin, const string& input_file,
+                         const string& output_file) {
+    uint64_t test_set_hash;
+    if (!HashTestSetSources(input_file, output_file, &test_set_hash))
+      Error("Cannot read test set");
+    return VerdictKeySeed(plugin.problem_name(), test_set_hash);
+  };
+  const JudgePlugin& default_plugin = *plugin_for(cl.Get("plugin", ""));
+  auto parse = [&](const auto& lines) {
+    return default_plugin.ParseCaseOutput(lines);
+  };
+  auto judge = [&](const PluginCaseInput& input,
+                   const PluginCaseOutput& correct_output,
+                   const PluginCaseOutput& attempt) {
+    return default_plugin.JudgeCase(input, correct_output, attempt);
+  };
+  if (args.size() == 4 && args[0] == "-batch") {
+    typedef LoadedTestSet<PluginCaseInput, PluginCaseOutput> PluginTestSet;
+    vector<BatchEntry> entries;
+    for (const string& line : ReadFileList(args[3]))
+      entries.push_back(ParseBatchEntry(line));
+    map<tuple<string, string, string>, PluginTestSet> loaded;
+    vector<const PluginTestSet*> test_sets;
+    vector<const JudgePlugin*> entry_plugins;
+    for (BatchEntry& entry : entries) {
+      if (entry.input_file.empty()) {
+        entry.input_file = args[1];
+        entry.output_file = args[2];
+      }
+      if (entry.plugin_file.empty()) entry.plugin_file = cl.Get("plugin", "");
+      const JudgePlugin* plugin = plugin_for(entry.plugin_file);
+      const auto key = make_tuple(entry.plugin_file, entry.input_file,
+                                  entry.output_file);
+      if (!loaded.count(key)) {
+        PluginTestSet& test_set = loaded[key];
+        test_set.input = plugin->ParseAllInput(entry.input_file);
+        test_set.correct_output =
+            ParseAllOutput(entry.output_file, [&](const auto& lines) {
+              return plugin->ParseCaseOutput(lines);
+            });
+        test_set.key_seed =
+            key_seed_for(*plugin, entry.input_file, entry.output_file);
+        for (size_t i = 0; i < test_set.input.size(); ++i)
+          test_set.cost += plugin->EstimateCaseCost(test_set.input[i]);
+      }
+      test_sets.push_back(&loaded[key]);
+      entry_plugins.push_back(plugin);
+    }
+    const int threads = ParseInt(
+        cl.Get("threads", Strint(max(1u, thread::hardware_concurrency()))));
+    const uint64_t max_inflight_mb =
+        ParseInt(cl.Get("max-inflight-mb", "4096"));
+    VerdictCache cache(cl.Get("verdict-cache", ""));
+    JudgeBatch(
+        entries, test_sets,
+        [&](size_t i, const auto& lines) {
+          return entry_plugins[i]->ParseCaseOutput(lines);
+        },
+        [&](size_t i, const PluginCaseInput& input,
+            const PluginCaseOutput& correct_output,
+            const PluginCaseOutput& attempt) {
+          return entry_plugins[i]->JudgeCase(input, correct_output, attempt);
+        },
+        &cache, threads, max_inflight_mb << 20, ParseJudgeBudgets(cl), cout);
+    if (cl.Has("stats")) ReportStats(cerr);
+    return 0;
+  }
+  if (args.size() != 3) return 1;
+  tokenize_threads = ParseInt(
+      cl.Get("threads", Strint(max(1u, thread::hardware_concurrency()))));
+  const JudgeBudgets budgets = ParseJudgeBudgets(cl);
+  case_cpu_budget_ns = budgets.case_ns;
+  ScopedDeadline deadline(budgets.run_ns);
+  const vector<PluginCaseInput> input = default_plugin.ParseAllInput(args[0]);
+  string e;
+  if (cl.Has("verdict-cache")) {
+    VerdictCache cache(cl.Get("verdict-cache", ""));
+    auto attempt = ParseAllOutputCached(
+        args[1], parse, input.size(),
+        key_seed_for(default_plugin, args[0], args[2]), cache);
+    e = JudgeAllCasesCached(input, ParseAllOutput(args[2], parse), attempt,
+                            judge, &cache);
+  } else {
+    auto attempt = ParseAllOutput(args[1], parse);
+    e = JudgeAllCases(input, ParseAllOutput(args[2], parse), attempt, judge);
+  }
+  if (cl.Has("stats")) ReportStats(cerr);
+  if (e.empty()) return 0;
+  Error(e);
+  return 1;
+}
+
+// Interactive judging: the judge exchanges many small messages with the
+// contestant's process over a pair of pipes. Writes are queued until the
+// judge flushes or waits for a reply, and reads take whatever the pipe holds
+// in one system call, so an exchange costs one write and one read rather than
+// an iostream flush per line.
+
+// Wall-clock time in nanoseconds, for interactive timeouts and benchmarks.
+int64_t MonotonicTimeNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Queued writes are flushed once they reach this size.
+const size_t kInteractiveWriteBuffer = 64 << 10;
+// Largest read from the contestant.
+const size_t kInteractiveReadChunk = 64 << 10;
+
+// Like write, except that writing to a pipe with no reader fails with EPIPE
+// instead of killing the process, without changing how SIGPIPE is handled:
+// the signal is blocked on the calling thread during the write, and a SIGPIPE
+// raised by it is discarded before it is unblocked.
+ssize_t WriteWithoutSigpipe(int fd, const void* data, size_t size) {
+  sigset_t sigpipe, old_mask, pending;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+  // If SIGPIPE is blocked or pending already, it is not ours to discard.
+  sigpending(&pending);
+  const bool own_sigpipe =
+      !sigismember(&old_mask, SIGPIPE) && !sigismember(&pending, SIGPIPE);
+  const ssize_t n = write(fd, data, size);
+  const int write_errno = errno;
+  if (own_sigpipe && n < 0 && errno == EPIPE) {
+    const timespec no_wait = {0, 0};
+    while (sigtimedwait(&sigpipe, nullptr, &no_wait) < 0 && errno == EINTR) {
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  errno = write_errno;
+  return n;
+}
+
+// The judge's end of a conversation with a contestant that reads what the
+// judge writes to out_fd and replies on in_fd. Both are made non-blocking and
+// are closed with the channel. Raises Error if the contestant does not reply
+// within timeout_ns of wall time, ends its output too early or closes its
+// input.
+class InteractiveChannel {
+ public:
+  InteractiveChannel(int in_fd, int out_fd,
+                     int64_t timeout_ns = 10000000000LL)
+      : in_fd_(in_fd), out_fd_(out_fd), timeout_ns_(timeout_ns) {
+    fcntl(in_fd_, F_SETFL, fcntl(in_fd_, F_GETFL) | O_NONBLOCK);
+    fcntl(out_fd_, F_SETFL, fcntl(out_fd_, F_GETFL) | O_NONBLOCK);
+  }
+  ~InteractiveChannel() {
+    close(in_fd_);
+    if (out_fd_ >= 0) close(out_fd_);
+  }
+  InteractiveChannel(const InteractiveChannel&) = delete;
+  InteractiveChannel& operator=(const InteractiveChannel&) = delete;
+
+  // Queues s for the contestant.
+  void Write(string_view s) {
+    out_ += s;
+    if (out_.size() >= kInteractiveWriteBuffer) Flush();
+  }
+
+  void WriteInt(long long v) {
+    char buffer[24];
+    Write(string_view(buffer, to_chars(buffer, end(buffer), v).ptr - buffer));
+  }
+
+  // Sends everything queued. Reads flush first, so this is only needed before
+  // waiting for something other than a reply.
+  void Flush() {
+    for (size_t sent = 0; sent < out_.size() && !Failed();) {
+      // Writing to a contestant that exited must fail, not kill the judge.
+      const ssize_t n = WriteWithoutSigpipe(out_fd_, out_.data() + sent,
+                                            out_.size() - sent);
+      if (n > 0) {
+        sent += n;
+      } else if (n == 0) {
+        Error("Cannot write to contestant");
+      } else if (errno == EPIPE) {
+        Error("Contestant closed its input");
+      } else if (errno == EAGAIN || errno == EINTR) {
+        // While the pipe is full, keep reading, in case the contestant is
+        // itself blocked on writing replies.
+        Wait(true);
+      } else {
+        Error("Cannot write to contestant");
+      }
+    }
+    out_.clear();
+  }
+
+  // Flushes and closes the contestant's input, so that it sees its end.
+  void CloseOutput() {
+    Flush();
+    close(out_fd_);
+    out_fd_ = -1;
+  }
+
+  // Next whitespace-separated token of the contestant, valid until the next
+  // read. Raises Error if its output ended.
+  string_view ReadToken() {
+    if (!WaitForToken()) {
+      Error("Contestant output ended");
+      return "";
+    }
+    size_t end = pos_;
+    while (end < in_.size() && !IsTokenSpace(in_[end])) ++end;
+    const string_view token = string_view(in_).substr(pos_, end - pos_);
+    pos_ = end;
+    return token;
+  }
+
+  // Next token of the contestant as an integer in [lo, hi].
+  long long ReadInt(long long lo, long long hi) {
+    const string_view token = ReadToken();
+    if (Failed()) return 0;
+    const long long v = ParseInt(token);
+    if (!Failed() && (v < lo || v > hi))
+      Error(Diagnostic{kNotAnInteger, token});
+    return v;
+  }
+
+  // Whether the contestant ended its output with no tokens left. Waits for
+  // the next token or the end.
+  bool AtEnd() { return !WaitForToken() && !Failed(); }
+
+ private:
+  // Flushes and waits until a whole token is buffered at pos_, followed by
+  // whitespace or the end of the output. Returns false at the end, or if an
+  // error was raised.
+  bool WaitForToken() {
+    Flush();
+    for (;;) {
+      while (pos_ < in_.size() && IsTokenSpace(in_[pos_])) ++pos_;
+      if (Failed()) return false;
+      if (eof_) return pos_ < in_.size();
+      for (size_t i = pos_; i < in_.size(); ++i)
+        if (IsTokenSpace(in_[i])) return true;
+      Wait(false);
+    }
+  }
+
+  // Waits for the contestant's output, and for room in its input if
+  // writable, reading whatever output arrives.
+  void Wait(bool writable) {
+    pollfd fds[2] = {{eof_ ? -1 : in_fd_, POLLIN, 0},
+                     {writable ? out_fd_ : -1, POLLOUT, 0}};
+    const int n = poll(fds, 2, (int)(timeout_ns_ / 1000000));
+    if (n == 0) {
+      Error("Contestant timed out");
+      return;
+    }
+    if (n < 0 || fds[0].revents == 0) return;
+    in_.erase(0, pos_);
+    pos_ = 0;
+    const size_t size = in_.size();
+    in_.resize(size + kInteractiveReadChunk);
+    const ssize_t r = read(in_fd_, &in_[size], kInteractiveReadChunk);
+    in_.resize(size + max<ssize_t>(r, 0));
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) eof_ = true;
+  }
+
+  const int in_fd_;
+  int out_fd_;
+  const int64_t timeout_ns_;
+  string in_;
+  size_t pos_ = 0;  // Next unread byte of in_.
+  bool eof_ = false;
+  string out_;
+};
+
+// A contestant process and the judge's channel to it.
+struct Contestant {
+  pid_t pid = -1;
+  unique_ptr<InteractiveChannel> channel;
+};
+
+// Starts a contestant that runs run(in_fd, out_fd) in a child process, reading
+// the judge's messages from in_fd and replying on out_fd.
+Contestant StartContestant(const function<void(int, int)>& run,
+                           int64_t timeout_ns = 10000000000LL) {
+  Contestant c;
+  // Close-on-exec, so that other contestants do not hold these pipes open.
+  int to_child[2], from_child[2];
+  if (pipe2(to_child, O_CLOEXEC) != 0) {
+    Error("Cannot start contestant");
+    return c;
+  }
+  if (pipe2(from_child, O_CLOEXEC) != 0) {
+    close(to_child[0]);
+    close(to_child[1]);
+    Error("Cannot start contestant");
+    return c;
+  }
+  c.pid = fork();
+  if (c.pid == 0) {
+    close(to_child[1]);
+    close(from_child[0]);
+    run(to_child[0], from_child[1]);
+    _exit(0);
+  }
+  close(to_child[0]);
+  close(from_child[1]);
+  if (c.pid < 0) {
+    close(to_child[1]);
+    close(from_child[0]);
+    Error("Cannot start contestant");
+    return c;
+  }
+  c.channel = make_unique<InteractiveChannel>(from_child[0], to_child[1],
+                                              timeout_ns);
+  return c;
+}
+
+// Starts command as a contestant, with its stdin and stdout as the pipes.
+Contestant StartContestant(const vector<string>& command,
+                           int64_t timeout_ns = 10000000000LL) {
+  return StartContestant(
+      [&](int in_fd, int out_fd) {
+        dup2(in_fd, 0);
+        dup2(out_fd, 1);
+        close(in_fd);
+        close(out_fd);
+        vector<char*> argv;
+        for (const string& arg : command) argv.push_back((char*)arg.c_str());
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+      },
+      timeout_ns);
+}
+
+// Closes the channel to c and waits up to timeout_ns for it to exit, killing
+// it after that. Returns its exit status, or 128 plus the signal that killed
+// it.
+int FinishContestant(Contestant* c, int64_t timeout_ns) {
+  c->channel.reset();
+  int status = 0;
+  const int64_t deadline = MonotonicTimeNs() + timeout_ns;
+  while (waitpid(c->pid, &status, WNOHANG) == 0) {
+    if (MonotonicTimeNs() > deadline) {
+      kill(c->pid, SIGKILL);
+      waitpid(c->pid, &status, 0);
+      break;
+    }
+    usleep(1000);
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Judges an interactive contestant: starts command, runs judge(channel),
+// which returns the verdict, "" if accepted, and closes the contestant's
+// input. An accepted contestant must then exit with status 0.
+template <typename JudgeF>
+string JudgeInteractive(const vector<string>& command, JudgeF judge,
+                        int64_t timeout_ns = 10000000000LL) {
+  Contestant c = StartContestant(command, timeout_ns);
+  if (Failed()) return "";
+  const string verdict = judge(*c.channel);
+  if (!verdict.empty() || Failed()) {
+    kill(c.pid, SIGKILL);
+    FinishContestant(&c, 0);
+    return verdict;
+  }
+  c.channel->CloseOutput();
+  const int status = FinishContestant(&c, timeout_ns);
+  if (status != 0) return "Contestant exited with status " + Strint(status);
+  return "";
+}
+
+// Fake contestant for BenchmarkInteractive: replies to each query "a b" with
+// a + b, flushing every reply, until its input ends.
+void RunAddingContestant(int in_fd, int out_fd) {
+  InteractiveChannel channel(in_fd, out_fd);
+  while (!channel.AtEnd()) {
+    const long long a = channel.ReadInt(-1000000000, 1000000000);
+    const long long b = channel.ReadInt(-1000000000, 1000000000);
+    channel.WriteInt(a + b);
+    channel.Write("\n");
+    channel.Flush();
+  }
+}
+
+// Wall-clock nanoseconds per exchange of num_exchanges exchanges with a local
+// fake contestant, sending batch queries before reading their replies.
+double BenchmarkInteractive(int num_exchanges, int batch) {
+  Contestant c = StartContestant(RunAddingContestant);
+  if (Failed()) return 0;
+  const int64_t start = MonotonicTimeNs();
+  for (int i = 0; i < num_exchanges && !Failed(); i += batch) {
+    const int n = min(batch, num_exchanges - i);
+    for (int j = i; j < i + n; ++j) {
+      c.channel->WriteInt(j);
+      c.channel->Write(" 1\n");
+    }
+    for (int j = i; j < i + n && !Failed(); ++j)
+      if (c.channel->ReadInt(j + 1, j + 1) != j + 1) break;
+  }
+  const int64_t elapsed = MonotonicTimeNs() - start;
+  FinishContestant(&c, 1000000000);
+  return (double)elapsed / max(num_exchanges, 1);
+}
+
+// Prints the latency and throughput of exchanges with a fake contestant, for
+// a few batch sizes.
+void ReportInteractiveBenchmark(int num_exchanges, ostream& out) {
+  for (int batch : {1, 16, 256}) {
+    const double ns = BenchmarkInteractive(num_exchanges, batch);
+    char line[100];
+    snprintf(line, sizeof(line),
+             "batch %d: %.2f us/exchange, %.0f exchanges/s", batch, ns / 1000,
+             1e9 / ns);
+    out << line << endl;
+  }
+}
+
+void TestInteractiveChannel() {
+  // Exchanges, in batches larger than the pipes hold.
+  Contestant c = StartContestant(RunAddingContestant);
+  for (int i = 0; i < 100; ++i) {
+    c.channel->WriteInt(i);
+    c.channel->Write(" -3\n");
+  }
+  for (int i = 0; i < 100; ++i) assert(c.channel->ReadInt(-3, 96) == i - 3);
+  for (int i = 0; i < 50000; ++i) c.channel->Write("1000000000 1000000000\n");
+  for (int i = 0; i < 50000; ++i)
+    assert(c.channel->ReadToken() == "2000000000");
+  c.channel->CloseOutput();
+  assert(c.channel->AtEnd());
+  AssertError(c.channel->ReadToken(), "Contestant output ended");
+  assert(FinishContestant(&c, 1000000000) == 0);
+  // Errors.
+  c = StartContestant([](int, int out_fd) { write(out_fd, " 7", 2); });
+  assert(c.channel->ReadToken() == "7");
+  AssertError(c.channel->ReadInt(0, 10), "Contestant output ended");
+  assert(FinishContestant(&c, 1000000000) == 0);
+  c = StartContestant(RunAddingContestant);
+  c.channel->Write("5 6\n");
+  AssertError(c.channel->ReadInt(0, 10), "Not an integer in range: 11");
+  FinishContestant(&c, 1000000000);
+  c = StartContestant([](int, int) { usleep(1000000); }, 20000000);
+  AssertError(c.channel->ReadToken(), "Contestant timed out");
+  assert(FinishContestant(&c, 0) == 128 + SIGKILL);
+  struct sigaction sigpipe_before, sigpipe_after;
+  sigaction(SIGPIPE, nullptr, &sigpipe_before);
+  c = StartContestant([](int in_fd, int) { close(in_fd); });
+  assert(c.channel->AtEnd());
+  c.channel->Write("1");
+  AssertError(c.channel->Flush(), "Contestant closed its input");
+  FinishContestant(&c, 1000000000);
+  // The judge survives without ignoring SIGPIPE, and none is left pending.
+  sigaction(SIGPIPE, nullptr, &sigpipe_after);
+  assert(sigpipe_after.sa_handler == sigpipe_before.sa_handler);
+  sigset_t pending;
+  sigpending(&pending);
+  assert(!sigismember(&pending, SIGPIPE));
+  // Whole interactions.
+  auto judge = [](InteractiveChannel& channel) -> string {
+    channel.Write("1 2\n");
+    const long long sum = channel.ReadInt(-10, 10);
+    return sum == 3 ? "" : "Wrong sum: " + Strint(sum);
+  };
+  assert(JudgeInteractive({"sh", "-c", "read a b; echo $((a + b))"}, judge) ==
+         "");
+  assert(JudgeInteractive({"sh", "-c", "read a b; echo $((a - b))"}, judge) ==
+         "Wrong sum: -1");
+  assert(JudgeInteractive({"sh", "-c", "read a b; echo 3; exit 4"}, judge) ==
+         "Contestant exited with status 4");
+  assert(BenchmarkInteractive(1000, 16) > 0);
+}
+
+void TestLib() {
+  TestStrint();
+  TestDeadlines();
+  TestTruncate();
+  TestRenderDiagnostic();
+  TestParseInt();
+  TestParseDouble();
+  TestBigInt();
+  TestLowercase();
+  TestTokenize();
+  TestLineReader();
+  TestSplitCases();
+  TestTokenizeLines();
+  TestSimdKernels();
+  TestWithinTolerance();
+  TestFindCaseHeaders();
+  TestCheckOutputText();
+  TestTokenizeCases();
+  TestCaseReader();
+  TestJudgeAllCases();
+  TestCaseVerdicts();
+  TestJudgeExactMatch();
+  TestDeterministicSum();
+  TestHashBytes();
+  TestBinaryReaderWriter();
+  TestTestSetImage();
+  TestSharedTestSet();
+  TestMakePrivateDir();
+  TestParseCommandLine();
+  TestVerdictCache();
+  TestJudgeAllCasesCached();
+  TestCatchError();
+  TestJudgeScheduler();
+  TestParseBatchEntry();
+  TestJudgeBatch();
+  TestChooseShardRanges();
+  TestMergeShardResults();
+  TestJudgeAllCasesSharded();
+  TestCaseIndex();
+  TestParseCaseSelection();
+  TestJudgeSelectedCases();
+  TestProblemTraits();
+  TestScoreAttempt();
+  TestJudgeAllCasesOnline();
+  TestJudgePlugin();
+  TestInteractiveChannel();
+}
+
+//////////////////////////////////////////////
+
+const string kProblemName = "reversort_engineering";
+
+struct CaseInput {
+  int N;
+  int C;
+};
+
+typedef vector<int> CaseOutput;
+
+CaseInput ParseCaseInput(istream& in) {
+  int N, C;
+  in >> N >> C;
+  return {
+    .N = N,
+    .C = C
+  };
+}
+
+const string kImpossibleKeyword = "IMPOSSIBLE";
+const string kBadImpossibleClaimError =
+    "Contestant claims a solution does not exist while judge finds a solution";
+const string kInvalidLengthError =
+    "Solution length does not match the number of elements in the array.";
+const string kInvalidElementsRange = "Output elements should be from 1 to N.";
+const string kDuplicateElementsFound = "Duplicate elements found in the output.";
+const string kWrongInformationError =
+    "Solution does not generate cost C.";
+const CaseOutput kImpossibleOutput = {};
+const string kAccepted = "";
+
+const string kImpossibleToken = Lowercase(kImpossibleKeyword);
+
+// Parses lines given as vector<vector<string>> or as a TokenCase.
+template <typename Lines>
+CaseOutput ParseCaseOutputLines(const Lines& lines) {
+  if (lines.size() != 1) {
+    Error("Wrong number of lines in case output");
+    return kImpossibleOutput;
+  }
+  if (lines[0].size() == 0) {
+    Error("Case output is empty");
+    return kImpossibleOutput;
+  }
+  if (lines[0].size() == 1 && lines[0][0] == kImpossibleToken) {
+    return kImpossibleOutput;
+  }
+  vector<int> output;
+  output.reserve(lines[0].size());
+  for (int i = 0; i < lines[0].size(); ++i) {
+    long long x = ParseInt(lines[0][i]);
+    if (Failed()) return kImpossibleOutput;
+    if (INT_MIN <= x && x <= INT_MAX) {
+      output.push_back((int) x);
+    } else {
+      Error("Number is outside signed 32-bit integer range");
+      return kImpossibleOutput;
+    }
+  }
+  return output;
+}
+
+CaseOutput ParseCaseOutput(const vector<vector<string>>& lines) {
+  return ParseCaseOutputLines(lines);
+}
+
+int solve(CaseOutput v) {
+  int curr_ans = 0;
+  for (int i = 0; i < v.size() - 1; i++) {
+    CheckDeadline();
+    if (Failed()) return 0;
+    int mnind = i + simd->min_index(v.data() + i, v.size() - i);
+    curr_ans += mnind - i + 1;
+    reverse(v.begin() + i, v.begin() + mnind + 1);
+  }
+  vector<int> tmp(v);
+  sort(tmp.begin(), tmp.end());
+  return curr_ans;
+}
+
+const VerdictKind kBadImpossibleClaim = {"BAD_IMPOSSIBLE_CLAIM",
+                                         kBadImpossibleClaimError.c_str()};
+const VerdictKind kInvalidLength = {"INVALID_LENGTH",
+                                    kInvalidLengthError.c_str()};
+const VerdictKind kInvalidElement = {"INVALID_ELEMENT",
+                                     kInvalidElementsRange.c_str()};
+const VerdictKind kDuplicateElement = {"DUPLICATE_ELEMENT",
+                                       kDuplicateElementsFound.c_str()};
+const VerdictKind kWrongCost = {"WRONG_COST", kWrongInformationError.c_str()};
+
+CaseVerdict JudgeCaseVerdict(const CaseInput& input,
+                             const CaseOutput& correct_output,
+                             const CaseOutput& attempt) {
   if (attempt == kImpossibleOutput) {
     return correct_output == kImpossibleOutput
-        ? kAccepted
-        : kBadImpossibleClaimError;
+        ? CaseVerdict()
+        : Reject(kBadImpossibleClaim);
   }
 
   if (attempt.size() != input.N) {
-    return kInvalidLengthError;
+    return Reject(kInvalidLength, input.N, attempt.size());
   }
 
-  if (any_of(attempt.begin(),
-             attempt.end(),
-             [input] (int x) { return x < 1 || x > input.N; })
-  ) {
-    return kInvalidElementsRange;
+  const size_t invalid =
+      simd->find_out_of_range(attempt.data(), attempt.size(), 1, input.N);
+  if (invalid != attempt.size()) {
+    return Reject(kInvalidElement, input.N, attempt[invalid]);
   }
   if(set<int>(attempt.begin(), attempt.end()).size() != attempt.size()) {
-     return kDuplicateElementsFound;
+     return Reject(kDuplicateElement);
   }
 
   const int attempt_answer = solve(attempt);
 
   if (attempt_answer != input.C) {
-    return kWrongInformationError;
+    return Reject(kWrongCost, input.C, attempt_answer);
+  }
+
+  return CaseVerdict();
+}
+
+string JudgeCase(const CaseInput& input, const CaseOutput& correct_output,
+                 const CaseOutput& attempt) {
+  return RenderCaseVerdict(JudgeCaseVerdict(input, correct_output, attempt));
+}
+
+// Columnar test set encoding: T, then the N and C arrays, the IMPOSSIBLE
+// flags, T + 1 offsets and the answer permutations of the possible cases back
+// to back, case i's from offset i to offset i + 1.
+void EncodeTestSet(const vector<CaseInput>& input,
+                   const vector<CaseOutput>& correct_output,
+                   BinaryWriter& out) {
+  const uint32_t t = input.size();
+  vector<int32_t> n(t), c(t), permutations;
+  vector<uint8_t> impossible(t);
+  vector<uint64_t> offsets(1, 0);
+  for (uint32_t i = 0; i < t; ++i) {
+    n[i] = input[i].N;
+    c[i] = input[i].C;
+    impossible[i] = correct_output[i] == kImpossibleOutput;
+    permutations.insert(permutations.end(), correct_output[i].begin(),
+                        correct_output[i].end());
+    offsets.push_back(permutations.size());
+  }
+  out.Write(t);
+  out.WriteArray(n);
+  out.WriteArray(c);
+  out.WriteArray(impossible);
+  out.WriteArray(offsets);
+  out.WriteArray(permutations);
+}
+
+// Serves a test set encoded by EncodeTestSet in place. Checks every case's
+// permutation bounds up front, so that reading a case cannot fail.
+bool ViewTestSet(BinaryReader& in, TestSetCases<CaseInput>* input,
+                 TestSetCases<CaseOutput>* correct_output) {
+  uint32_t t;
+  UnalignedArray<int32_t> n, c, permutations;
+  UnalignedArray<uint8_t> impossible;
+  UnalignedArray<uint64_t> offsets;
+  if (!in.Read(&t) || !in.ViewArray(t, &n) || !in.ViewArray(t, &c) ||
+      !in.ViewArray(t, &impossible) || !in.ViewArray(t + 1ULL, &offsets))
+    return false;
+  if (offsets[0] != 0 || !in.ViewArray(offsets[t], &permutations))
+    return false;
+  for (uint32_t i = 0; i < t; ++i) {
+    const uint64_t length = impossible[i] ? 0 : n[i];
+    if ((!impossible[i] && n[i] < 0) || offsets[i] > offsets[i + 1] ||
+        offsets[i + 1] - offsets[i] != length)
+      return false;
+  }
+  *input = TestSetCases<CaseInput>(
+      t, [n, c](size_t i) { return CaseInput{n[i], c[i]}; });
+  *correct_output = TestSetCases<CaseOutput>(
+      t, [offsets, permutations](size_t i) {
+        CaseOutput output(offsets[i + 1] - offsets[i]);
+        permutations.CopyTo(offsets[i], output.size(), output.data());
+        return output;
+      });
+  return true;
+}
+
+void TestEncodeTestSet() {
+  const vector<CaseInput> input = {{2, 1}, {3, 1}, {4, 6}};
+  const vector<CaseOutput> output = {{1, 2}, kImpossibleOutput, {4, 2, 1, 3}};
+  BinaryWriter out;
+  EncodeTestSet(input, output, out);
+  BinaryReader in(out.buffer());
+  TestSetCases<CaseInput> viewed_input;
+  TestSetCases<CaseOutput> viewed_output;
+  assert(ViewTestSet(in, &viewed_input, &viewed_output) && in.AtEnd());
+  assert(viewed_input.size() == 3 && viewed_output.size() == 3);
+  for (int i = 0; i < 3; ++i) {
+    assert(viewed_input[i].N == input[i].N);
+    assert(viewed_input[i].C == input[i].C);
+    assert(viewed_output[i] == output[i]);
   }
+  const string truncated = out.buffer().substr(0, out.buffer().size() - 4);
+  BinaryReader short_in(truncated);
+  assert(!ViewTestSet(short_in, &viewed_input, &viewed_output));
+  // Negative lengths are rejected, not compared as huge ones.
+  BinaryWriter negative;
+  EncodeTestSet({{-1, 0}}, {{1}}, negative);
+  BinaryReader negative_in(negative.buffer());
+  assert(!ViewTestSet(negative_in, &viewed_input, &viewed_output));
+  // So are permutations that do not have N elements.
+  BinaryWriter short_permutation;
+  EncodeTestSet({{3, 0}}, {{1, 2}}, short_permutation);
+  BinaryReader short_permutation_in(short_permutation.buffer());
+  assert(!ViewTestSet(short_permutation_in, &viewed_input, &viewed_output));
+  // The cases are read from the image, which they keep alive.
+  const uint64_t hash = 99;
+  auto image = make_shared<const string>(BuildTestSetImage(hash, out.buffer()));
+  assert(ViewTestSetImage(*image, hash, image, ViewTestSet, &viewed_input,
+                          &viewed_output));
+  image.reset();
+  assert(viewed_output[2] == output[2] && viewed_input[1].N == 3);
+  assert(!ViewTestSetImage(BuildTestSetImage(hash, truncated), hash, nullptr,
+                           ViewTestSet, &viewed_input, &viewed_output));
+  assert(viewed_output[0] == output[0]);
+}
 
-  return kAccepted;
+// Judging a case is dominated by the quadratic solve.
+uint64_t EstimateCaseCost(const CaseInput& input) {
+  return (uint64_t)input.N * input.N;
 }
 
+// Reversort Engineering as a problem type for the library's templates.
+struct ReversortProblem {
+  typedef CaseInput Input;
+  typedef CaseOutput Output;
+  static CaseInput ParseCaseInput(istream& in) { return ::ParseCaseInput(in); }
+  static CaseOutput ParseCaseOutput(const vector<vector<string>>& lines) {
+    return ParseCaseOutputLines(lines);
+  }
+  static CaseOutput ParseCaseOutput(const TokenCase& lines) {
+    return ParseCaseOutputLines(lines);
+  }
+  static CaseVerdict JudgeCase(const CaseInput& input,
+                               const CaseOutput& correct_output,
+                               const CaseOutput& attempt) {
+    return JudgeCaseVerdict(input, correct_output, attempt);
+  }
+  static uint64_t EstimateCaseCost(const CaseInput& input) {
+    return ::EstimateCaseCost(input);
+  }
+};
+
 void Test() {
   assert(JudgeCase({2, 1}, {1, 2}, kImpossibleOutput) ==
          kBadImpossibleClaimError);
@@ -418,20 +6692,279 @@ void Test() {
 
   assert(JudgeCase({3, 1}, kImpossibleOutput, kImpossibleOutput) ==
          kAccepted);
+
+  const CaseVerdict v = JudgeCaseVerdict({3, 3}, {2, 1, 3}, {3, 2, 1});
+  assert(v.kind == &kWrongCost && v.expected == 3 && v.got == 4);
+  assert(JudgeCaseVerdict({2, 1}, {1, 2}, {1, 3}).got == 3);
+
+  TestEncodeTestSet();
+}
+
+// Serves the test set precompiled for the given sources, from shared memory
+// if the flags ask for it. Returns false if it has to be parsed from text.
+bool LoadPrecompiledTestSet(const CommandLine& cl, const string& input_file,
+                            const string& output_file,
+                            TestSetCases<CaseInput>* input,
+                            TestSetCases<CaseOutput>* correct_output) {
+  const string cache_file = output_file + ".testset";
+  if (cl.Has("shared-test-set")) {
+    const uint64_t budget_mb =
+        ParseInt(cl.Get("shared-test-set-budget-mb", "1024"));
+    if (LoadSharedTestSet(input_file, output_file, cache_file, budget_mb << 20,
+                          ParseCaseInput, ParseCaseOutput, EncodeTestSet,
+                          ViewTestSet, input, correct_output))
+      return true;
+  }
+  return LoadTestSet(input_file, output_file, cache_file, ViewTestSet, input,
+                     correct_output);
 }
 
+uint64_t VerdictKeySeedForTestSet(const string& input_file,
+                                  const string& output_file) {
+  uint64_t test_set_hash;
+  if (!HashTestSetSources(input_file, output_file, &test_set_hash))
+    Error("Cannot read test set");
+  return VerdictKeySeed(kProblemName, test_set_hash);
+}
+
+// Loads a test set for batch judging, precompiled if possible.
+LoadedTestSet<CaseInput, CaseOutput> LoadBatchTestSet(const CommandLine& cl,
+                                                      const string& input_file,
+                                                      const string& output_file) {
+  LoadedTestSet<CaseInput, CaseOutput> test_set;
+  if (!LoadPrecompiledTestSet(cl, input_file, output_file, &test_set.input,
+                              &test_set.correct_output)) {
+    test_set.input = ParseAllInput<ReversortProblem>(input_file);
+    test_set.correct_output = ParseAllOutput<ReversortProblem>(output_file);
+  }
+  test_set.key_seed = VerdictKeySeedForTestSet(input_file, output_file);
+  test_set.cost = EstimateTestSetCost(test_set.input, EstimateCaseCost);
+  return test_set;
+}
+
+#ifdef JUDGE_PLUGIN
+// Built as a problem plugin:
+//   g++ -O2 -shared -fPIC -fvisibility=hidden -DJUDGE_PLUGIN custom_judge.cc
+extern "C" __attribute__((visibility("default"))) const JudgePluginApi*
+JUDGE_PLUGIN_ENTRY_POINT() {
+  return JudgePluginAdapter<ReversortProblem>::Api(kProblemName.c_str());
+}
+#else
+// Usage:
+//   custom_judge -2                        runs the tests.
+//   custom_judge -compile INPUT OUTPUT CACHE
+//                                          precompiles a test set.
+//   custom_judge -evict-shared             unlinks idle shared test sets.
+//   custom_judge -bench-interactive [EXCHANGES]
+//                                          times exchanges with a fake
+//                                          interactive contestant.
+//   custom_judge [flags] INPUT ATTEMPT OUTPUT
+//                                          judges ATTEMPT, using the test set
+//                                          precompiled at OUTPUT.testset when
+//                                          it is up to date. ATTEMPT may be
+//                                          "-" to read it from stdin.
+//   custom_judge [flags] -batch INPUT OUTPUT ATTEMPT_LIST
+//                                          judges every attempt listed in
+//                                          ATTEMPT_LIST ("-" for stdin), one
+//                                          line ATTEMPT[<tab>PRIORITY[<tab>
+//                                          INPUT<tab>OUTPUT[<tab>PLUGIN]]] per
+//                                          attempt,
+//                                          writing one verdict line per
+//                                          attempt on stdout as it finishes.
+//                                          Lower priorities are more urgent.
+// Flags:
+//   --plugin=PLUGIN           judges with the problem logic of a plugin built
+//                             with -DJUDGE_PLUGIN instead of this judge's own.
+//   --shared-test-set         attaches to the test set in shared memory,
+//                             publishing it for other judges if needed.
+//   --shared-test-set-budget-mb=N
+//                             host memory for shared test sets (default 1024).
+//   --verdict-cache=FILE      reuses and records per-case verdicts in FILE.
+//                             Batch mode always caches verdicts in memory.
+//   --online                  judges ATTEMPT while it is being written, such
+//                             as a pipe or "-", each case as soon as it is
+//                             complete, stopping at the first wrong case.
+//   --follow-pid=PID          with --online, keeps reading at the end of
+//                             ATTEMPT while process PID is running.
+//   --shards=N                splits ATTEMPT across N worker processes,
+//                             unless it is read from stdin.
+//   --cases=LIST              judges only the cases in LIST, such as
+//                             57,90-100, reading only those cases of ATTEMPT
+//                             and CORRECT_OUTPUT through case indexes saved
+//                             in $XDG_CACHE_HOME/cj-caseidx.
+//   --check-structure         with --cases, still checks every case header
+//                             and the number of cases of both files.
+//   --exact-match             accepts ATTEMPT if each case has the tokens of
+//                             OUTPUT, up to whitespace and letter case,
+//                             instead of judging it as this problem.
+//   --threads=N               batch mode threads, or threads to tokenize a
+//                             large attempt with (default: all cores).
+//   --max-inflight-mb=N       batch mode estimated memory cap (default 4096).
+//   --deadline-ms=N           CPU time limit of judging an attempt. A judge
+//                             that runs out prints "Judge time limit
+//                             exceeded" and exits with code 2.
+//   --case-deadline-ms=N      CPU time limit of judging one case.
+//   --verdict-json            also prints the verdict as one line of JSON on
+//                             stdout (see FormatVerdictJson). Judges without
+//                             --verdict-cache, which keeps only messages.
+//   --simd=LEVEL              uses the scalar, sse4.2 or avx2 kernels instead
+//                             of the best ones the CPU supports.
+//   --stats                   reports judge counters and the SIMD level in
+//                             use to stderr.
 int main(int argc, const char* argv[]) {
-  if (argc == 2 && string(argv[1]) == "-2") {
+  const CommandLine cl = ParseCommandLine(argc, argv);
+  const vector<string>& args = cl.args;
+  if (cl.Has("simd") && !SetSimdLevel(cl.Get("simd", "")))
+    Error("Unsupported SIMD level: " + cl.Get("simd", ""));
+  if (args.size() == 1 && args[0] == "-2") {
     TestLib();
     Test();
     cerr << "All tests passed!" << endl;
     return 0;
   }
-  if (argc != 4) return 1;
-  auto input = ParseAllInput(argv[1], ParseCaseInput);
-  auto attempt = ParseAllOutput(argv[2], ParseCaseOutput);
-  auto correct_output = ParseAllOutput(argv[3], ParseCaseOutput);
-  string e = JudgeAllCases(input, correct_output, attempt, JudgeCase);
+  if (cl.Has("plugin")) return RunPluginHost(cl);
+  if (args.size() == 4 && args[0] == "-compile") {
+    if (CompileTestSet(args[1], args[2], args[3], ParseCaseInput,
+                       ParseCaseOutput, EncodeTestSet))
+      return 0;
+    Error(string("Cannot write test set cache: ") + args[3]);
+  }
+  if (args.size() == 1 && args[0] == "-evict-shared") {
+    EvictSharedTestSets(0);
+    return 0;
+  }
+  if (!args.empty() && args.size() <= 2 && args[0] == "-bench-interactive") {
+    ReportInteractiveBenchmark(args.size() == 2 ? ParseInt(args[1]) : 100000,
+                               cout);
+    return 0;
+  }
+  TestSetCases<CaseInput> input;
+  TestSetCases<CaseOutput> correct_output;
+  if (args.size() == 4 && args[0] == "-batch") {
+    vector<BatchEntry> entries;
+    for (const string& line : ReadFileList(args[3]))
+      entries.push_back(ParseBatchEntry(line));
+    map<pair<string, string>, LoadedTestSet<CaseInput, CaseOutput>> loaded;
+    vector<const LoadedTestSet<CaseInput, CaseOutput>*> test_sets;
+    for (BatchEntry& entry : entries) {
+      if (entry.input_file.empty()) {
+        entry.input_file = args[1];
+        entry.output_file = args[2];
+      }
+      const pair<string, string> key(entry.input_file, entry.output_file);
+      if (!loaded.count(key))
+        loaded[key] = LoadBatchTestSet(cl, key.first, key.second);
+      test_sets.push_back(&loaded[key]);
+    }
+    const int threads = ParseInt(
+        cl.Get("threads", Strint(max(1u, thread::hardware_concurrency()))));
+    const uint64_t max_inflight_mb =
+        ParseInt(cl.Get("max-inflight-mb", "4096"));
+    VerdictCache cache(cl.Get("verdict-cache", ""));
+    JudgeBatch(
+        entries, test_sets,
+        [](size_t, const vector<vector<string>>& lines) {
+          return ReversortProblem::ParseCaseOutput(lines);
+        },
+        [](size_t, const CaseInput& input, const CaseOutput& correct_output,
+           const CaseOutput& attempt) {
+          return ReversortProblem::JudgeCase(input, correct_output, attempt);
+        },
+        &cache, threads, max_inflight_mb << 20, ParseJudgeBudgets(cl), cout);
+    if (cl.Has("stats")) ReportStats(cerr);
+    return 0;
+  }
+  if (args.size() != 3) return 1;
+  tokenize_threads = ParseInt(
+      cl.Get("threads", Strint(max(1u, thread::hardware_concurrency()))));
+  const JudgeBudgets budgets = ParseJudgeBudgets(cl);
+  case_cpu_budget_ns = budgets.case_ns;
+  ScopedDeadline deadline(budgets.run_ns);
+  string e;
+  AttemptVerdict verdict;
+  bool typed = false;
+  auto judge = [&] {
+    if (cl.Has("exact-match")) {
+      e = JudgeExactMatch(args[2], args[1]);
+      return;
+    }
+    const bool cached =
+        LoadPrecompiledTestSet(cl, args[0], args[2], &input, &correct_output);
+    if (!cached) input = ParseAllInput<ReversortProblem>(args[0]);
+    if (Failed()) return;
+    if (cl.Has("cases")) {
+      const vector<size_t> selected =
+          ParseCaseSelection(cl.Get("cases", ""), input.size());
+      if (Failed()) return;
+      const bool check_structure = cl.Has("check-structure");
+      auto attempt = ParseSelectedOutput(
+          args[1], ParseCaseOutputOf<ReversortProblem>(), selected,
+          input.size(), check_structure);
+      if (Failed()) return;
+      vector<CaseOutput> correct_selected;
+      if (cached) {
+        for (size_t k : selected) correct_selected.push_back(correct_output[k]);
+      } else {
+        correct_selected = ParseSelectedOutput(
+            args[2], ParseCaseOutputOf<ReversortProblem>(), selected,
+            input.size(), check_structure);
+        if (Failed()) return;
+      }
+      e = JudgeSelectedCases(input, selected, correct_selected, attempt,
+                             JudgeCaseOf<ReversortProblem>());
+    } else if (cl.Has("online")) {
+      if (!cached) correct_output = ParseAllOutput<ReversortProblem>(args[2]);
+      if (Failed()) return;
+      CaseReader reader(args[1]);
+      if (cl.Has("follow-pid")) {
+        const pid_t pid = ParseInt(cl.Get("follow-pid", ""));
+        reader.Follow([pid] { return ProcessRunning(pid); });
+      }
+      e = JudgeAllCasesOnline(input, correct_output, &reader,
+                              ParseCaseOutputOf<ReversortProblem>(),
+                              JudgeCaseOf<ReversortProblem>());
+    } else if (cl.Has("shards") && args[1] != "-") {
+      if (!cached) correct_output = ParseAllOutput<ReversortProblem>(args[2]);
+      if (Failed()) return;
+      e = JudgeAllCasesSharded(input, correct_output, args[1],
+                               ParseCaseOutputOf<ReversortProblem>(),
+                               JudgeCaseOf<ReversortProblem>(),
+                               ParseInt(cl.Get("shards", "1")));
+    } else if (cl.Has("verdict-cache") && !cl.Has("verdict-json")) {
+      VerdictCache cache(cl.Get("verdict-cache", ""));
+      auto attempt = ParseAllOutputCached(
+          args[1], ParseCaseOutputOf<ReversortProblem>(), input.size(),
+          VerdictKeySeedForTestSet(args[0], args[2]), cache);
+      if (Failed()) return;
+      if (!cached) correct_output = ParseAllOutput<ReversortProblem>(args[2]);
+      if (Failed()) return;
+      e = JudgeAllCasesCached(input, correct_output, attempt,
+                              JudgeCaseOf<ReversortProblem>(), &cache);
+    } else {
+      auto attempt = ParseAllOutput<ReversortProblem>(args[1]);
+      if (Failed()) return;
+      if (!cached) correct_output = ParseAllOutput<ReversortProblem>(args[2]);
+      if (Failed()) return;
+      verdict = JudgeAllCasesVerdict(input, correct_output, attempt,
+                                     JudgeCaseOf<ReversortProblem>());
+      e = RenderAttemptVerdict(verdict);
+      typed = true;
+    }
+  };
+  if (cl.Has("verdict-json")) {
+    string error;
+    if (!CatchError(judge, &error)) {
+      cout << FormatVerdictJson(error) << endl;
+      if (error == kJudgeTimeLimitError) JudgeTimeLimitExceeded();
+      Error(error);
+    }
+    cout << (typed ? FormatVerdictJson(verdict) : FormatVerdictJson(e))
+         << endl;
+  } else {
+    judge();
+  }
+  if (cl.Has("stats")) ReportStats(cerr);
   if (e.empty()) return 0;
   Error(e);
 }
+#endif  // JUDGE_PLUGIN